@@ -0,0 +1,429 @@
+#include "../headers/simulation.h"
+#include "../headers/ipc.h"
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <functional>
+#include <memory>
+#include <vector>
+
+// Times the simulation and challan hot paths at a range of vehicle counts
+// and worker counts, writes the results as JSON and compares them with a
+// stored baseline.
+//
+// Vehicle counts above one crossroads' worth are reached by running many
+// independent crossings side by side, like RoadNetwork partitions. The
+// tick paths run as tasks on the TaskScheduler, a few per worker.
+//
+// g++ -O2 bench/benchmark.cpp -o benchmark -lsfml-graphics -lsfml-window -lsfml-system
+// ./benchmark [--vehicles 10,100,1000,10000,100000] [--threads 1,2,4] [--min-time S]
+//             [--json FILE] [--baseline bench/baseline.json] [--tolerance 0.25]
+// Exits 1 if a result is slower than the baseline by more than the tolerance.
+
+static const int CROSSING_VEHICLES = VehicleTable::CAPACITY * 4;
+
+// One intersection's four direction tables and spawner
+struct Crossing {
+    VehicleTable tables[4];
+    VehicleSpawner spawner;
+    ThreadData data[4];
+};
+
+struct Result {
+    std::string name;
+    long vehicles;
+    int threads;
+    double nsPerOp;
+    long ops;
+};
+
+class Bench;
+
+// A slice of the fleet's direction tables, one task of the tick graph
+struct Chunk {
+    Bench* bench;
+    int first, last;  // flat direction indices, crossing * 4 + direction
+    TrafficManager* manager;  // owned by this chunk alone
+};
+
+class Bench {
+public:
+    enum Path { PATH_UPDATE, PATH_SPAWN, PATH_VIOLATIONS };
+
+    std::vector<std::unique_ptr<Crossing>> fleet;
+    // One per chunk: TrafficStats has one writer per direction, so chunks
+    // running in parallel must not share a manager. A manager per crossing
+    // would cost half a megabyte each at 100k vehicles.
+    std::vector<std::unique_ptr<TrafficManager>> managers;
+    SimClock clock;
+    CarFollowingMode mode;
+    IdmParams idm;
+    Path path;
+
+    Bench() : clock(SIM_STEP, 0.0f), mode(FOLLOW_CLASSIC), path(PATH_UPDATE) {}
+
+    ThreadData* direction(int flat) {
+        return &fleet[flat / 4]->data[flat % 4];
+    }
+
+    int directions() const {
+        return fleet.size() * 4;
+    }
+
+    // Fresh crossings holding vehicles in total, queued up to the stop
+    // line so nothing leaves the screen while the clock runs
+    void build(long vehicles, bool fill) {
+        fleet.clear();
+        if (managers.empty()) managers.emplace_back(new TrafficManager(true));
+        long crossings = std::max(1L, (vehicles + CROSSING_VEHICLES - 1) / CROSSING_VEHICLES);
+        for (long c = 0; c < crossings; c++) {
+            fleet.emplace_back(new Crossing());
+            Crossing& crossing = *fleet.back();
+            std::vector<VehicleTable*> tables;
+            for (int d = 0; d < 4; d++) {
+                crossing.tables[d].direction = d;
+                crossing.data[d] = {&crossing.tables[d], &crossing.spawner, d, managers[0].get(),
+                                    &mode, &idm, &clock};
+                tables.push_back(&crossing.tables[d]);
+            }
+            crossing.spawner.setVehicles(tables);
+        }
+        if (!fill) return;
+
+        long placed = 0;
+        for (int k = 0; k < MAX_VEHICLES_PER_LANE && placed < vehicles; k++) {
+            for (long c = 0; c < crossings && placed < vehicles; c++) {
+                for (int flat = 0; flat < 8 && placed < vehicles; flat++) {
+                    Crossing& crossing = *fleet[c];
+                    VehicleTable& table = crossing.tables[flat / 2];
+                    int lane = flat % 2 + 1;
+                    int slot = table.spawn(lane == 2 && k % 3 == 0 ? "Heavy" : "Light", lane, 0);
+                    if (slot < 0) continue;
+                    float spacing = (table.stopLine() - 20) / MAX_VEHICLES_PER_LANE;
+                    table.setAlong(slot, table.stopLine() - 10 - k * spacing);
+                    crossing.spawner.incrementLaneCount(flat / 2, lane);
+                    placed++;
+                }
+            }
+        }
+    }
+
+    long alive() const {
+        long n = 0;
+        for (const auto& crossing : fleet) {
+            for (int d = 0; d < 4; d++) n += crossing->tables[d].size();
+        }
+        return n;
+    }
+
+    static void chunkTask(void* arg) {
+        Chunk* chunk = (Chunk*)arg;
+        Bench* bench = chunk->bench;
+        float dt = bench->clock.step();
+        for (int flat = chunk->first; flat < chunk->last; flat++) {
+            ThreadData* data = bench->direction(flat);
+            switch (bench->path) {
+                case PATH_UPDATE: Simulation::updateVehicles(data, dt); break;
+                case PATH_SPAWN: Simulation::spawnVehicles(data, dt); break;
+                case PATH_VIOLATIONS: chunk->manager->checkViolations(*data->vehicles, dt); break;
+            }
+        }
+    }
+
+    // A few chunks per worker so stealing can even out the load
+    void buildGraph(TaskGraph& graph, std::vector<Chunk>& chunks, int workers) {
+        int count = std::min(directions(), std::min(workers * 4, TaskGraph::MAX_TASKS));
+        chunks.resize(count);
+        while ((int)managers.size() < count) managers.emplace_back(new TrafficManager(true));
+        graph.count = 0;
+        for (int i = 0; i < count; i++) {
+            chunks[i] = {this, (int)((long)directions() * i / count),
+                         (int)((long)directions() * (i + 1) / count), managers[i].get()};
+            // spawn and lane updates report to the manager in ThreadData
+            for (int flat = chunks[i].first; flat < chunks[i].last; flat++) {
+                direction(flat)->trafficManager = chunks[i].manager;
+            }
+            graph.add("chunk", chunkTask, &chunks[i]);
+        }
+    }
+};
+
+static double secondsSince(std::chrono::steady_clock::time_point start) {
+    return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+// Repeats setup + body until body has run for minTime in total. body
+// returns how many operations it did.
+static Result measure(const char* name, long vehicles, int threads, double minTime,
+                      const std::function<void()>& setup, const std::function<long()>& body) {
+    double spent = 0;
+    long ops = 0;
+    while (spent < minTime || ops == 0) {
+        setup();
+        auto start = std::chrono::steady_clock::now();
+        ops += body();
+        spent += secondsSince(start);
+    }
+    Result result = {name, vehicles, threads, spent * 1e9 / ops, ops};
+    printf("%-18s %7ld vehicles %3d threads %10.1f ns/op %10ld ops\n", name, vehicles, threads,
+           result.nsPerOp, ops);
+    fflush(stdout);
+    return result;
+}
+
+static void tickPaths(Bench& bench, std::vector<Result>& results, long vehicles, int threads,
+                      double minTime) {
+    const int TICKS = 60;
+    TaskScheduler scheduler(threads);
+    TaskGraph* graph = new TaskGraph();
+    std::vector<Chunk> chunks;
+
+    struct Case {
+        const char* name;
+        Bench::Path path;
+        CarFollowingMode mode;
+        bool fill;
+    };
+    const Case cases[] = {
+        {"update_classic", Bench::PATH_UPDATE, FOLLOW_CLASSIC, true},
+        {"update_idm", Bench::PATH_UPDATE, FOLLOW_IDM, true},
+        {"violations", Bench::PATH_VIOLATIONS, FOLLOW_CLASSIC, true},
+        {"spawn", Bench::PATH_SPAWN, FOLLOW_CLASSIC, false},
+    };
+    for (const Case& c : cases) {
+        auto setup = [&]() {
+            bench.path = c.path;
+            bench.mode = c.mode;
+            bench.build(vehicles, c.fill);
+            bench.buildGraph(*graph, chunks, scheduler.size());
+            if (c.path != Bench::PATH_VIOLATIONS) return;
+            // half the fleet over the limit, so violation episodes open
+            for (auto& crossing : bench.fleet) {
+                for (int d = 0; d < 4; d++) {
+                    VehicleTable& table = crossing->tables[d];
+                    for (int i = 0; i < VehicleTable::CAPACITY; i++) {
+                        if (table.alive(i) && i % 2) table.currentSpeed[i] = 75;
+                    }
+                }
+            }
+        };
+        // vehicle updates per tick for the tick paths, spawn calls for spawning
+        auto body = [&]() {
+            long ops = 0;
+            for (int t = 0; t < TICKS; t++) {
+                ops += c.path == Bench::PATH_SPAWN ? bench.directions() : bench.alive();
+                scheduler.run(*graph);
+                bench.clock.advance();
+            }
+            return ops;
+        };
+        results.push_back(measure(c.name, vehicles, threads, minTime, setup, body));
+    }
+    delete graph;
+}
+
+// Tells the compiler memory may have changed, so repeated calls on the
+// same tables are not folded into one
+static inline void clobber() {
+    asm volatile("" : : : "memory");
+}
+
+static void spawnAreaClear(Bench& bench, std::vector<Result>& results, long vehicles, double minTime) {
+    bench.build(vehicles, true);
+    auto setup = [&]() {};
+    auto body = [&]() {
+        long ops = 0;
+        volatile long clear = 0;
+        for (int repeat = 0; repeat < 1000; repeat++) {
+            clobber();
+            for (auto& crossing : bench.fleet) {
+                for (int d = 0; d < 4; d++) {
+                    clear += crossing->spawner.isSpawnAreaClear(d, 1);
+                    clear += crossing->spawner.isSpawnAreaClear(d, 2);
+                    ops += 2;
+                }
+            }
+        }
+        return ops;
+    };
+    results.push_back(measure("spawn_area_clear", vehicles, 1, minTime, setup, body));
+}
+
+// The challan service's ingest path without the window or ledger: decode
+// batch frames, drop plates that already have a challan, store the rest.
+// Every plate is sent twice, so each run inserts one challan per vehicle.
+static void challanIngest(std::vector<Result>& results, long vehicles, double minTime) {
+    std::string wire;
+    ChallanBatch batch;
+    memset(&batch, 0, sizeof(batch));
+    for (long i = 0; i < vehicles * 2; i++) {
+        ChallanRecord& record = batch.records[batch.count++];
+        snprintf(record.vehicleId, sizeof(record.vehicleId), "Light%ld", i % vehicles);
+        record.peakSpeed = 75;
+        record.isHeavy = 0;
+        if (batch.count == ChallanBatch::MAX_RECORDS || i == vehicles * 2 - 1) {
+            appendBatchFrame(wire, batch);
+            batch.count = 0;
+        }
+    }
+
+    std::unique_ptr<ChallanStore> store;
+    auto setup = [&]() {
+        store.reset(new ChallanStore());
+        store->reserve(vehicles);
+    };
+    auto body = [&]() {
+        FrameDecoder decoder;
+        FrameHeader header;
+        const char* payload;
+        long ops = 0, inserted = 0;
+        // read sized pieces, like a FIFO hands them over
+        const size_t PIECE = 4096;
+        for (size_t at = 0; at < wire.size(); at += PIECE) {
+            decoder.feed(wire.data() + at, std::min(PIECE, wire.size() - at));
+            while (decoder.next(header, payload)) {
+                uint32_t count = batchRecordCount(header, payload);
+                for (uint32_t i = 0; i < count; i++) {
+                    ChallanRecord record;
+                    batchRecord(payload, i, record);
+                    ops++;
+                    if (store->hasPlate(record.vehicleId)) continue;
+                    ChallanEntry entry;
+                    memset(&entry, 0, sizeof(entry));
+                    entry.id = store->allocateId();
+                    snprintf(entry.plate, sizeof(entry.plate), "%s", record.vehicleId);
+                    entry.amount = 5850;
+                    entry.status = CHALLAN_UNPAID;
+                    store->insert(entry);
+                    inserted++;
+                }
+            }
+        }
+        // a bad decode dedups everything against one plate and times nothing
+        if (ops != vehicles * 2 || inserted != vehicles) {
+            fprintf(stderr, "challan_ingest: decoded %ld of %ld records, inserted %ld of %ld\n",
+                    ops, vehicles * 2, inserted, vehicles);
+            exit(1);
+        }
+        return ops;
+    };
+    results.push_back(measure("challan_ingest", vehicles, 1, minTime, setup, body));
+}
+
+static std::vector<long> parseList(const char* text) {
+    std::vector<long> values;
+    for (const char* p = text; *p;) {
+        char* end;
+        long value = strtol(p, &end, 10);
+        if (end == p) break;
+        if (value > 0) values.push_back(value);
+        p = *end == ',' ? end + 1 : end;
+    }
+    return values;
+}
+
+static bool writeJson(const char* path, const std::vector<Result>& results) {
+    FILE* out = fopen(path, "w");
+    if (!out) {
+        perror(path);
+        return false;
+    }
+    // one result per line, which is also what readBaseline expects
+    fprintf(out, "{\n  \"unit\": \"ns_per_op\",\n  \"results\": [\n");
+    for (size_t i = 0; i < results.size(); i++) {
+        const Result& r = results[i];
+        fprintf(out, "    {\"name\": \"%s\", \"vehicles\": %ld, \"threads\": %d, \"ns_per_op\": %.2f, \"ops\": %ld}%s\n",
+                r.name.c_str(), r.vehicles, r.threads, r.nsPerOp, r.ops,
+                i + 1 < results.size() ? "," : "");
+    }
+    fprintf(out, "  ]\n}\n");
+    fclose(out);
+    return true;
+}
+
+static std::vector<Result> readBaseline(const char* path) {
+    std::vector<Result> baseline;
+    FILE* in = fopen(path, "r");
+    if (!in) {
+        perror(path);
+        return baseline;
+    }
+    char line[512], name[64];
+    Result r;
+    while (fgets(line, sizeof(line), in)) {
+        if (sscanf(line, " {\"name\": \"%63[^\"]\", \"vehicles\": %ld, \"threads\": %d, \"ns_per_op\": %lf, \"ops\": %ld",
+                   name, &r.vehicles, &r.threads, &r.nsPerOp, &r.ops) == 5) {
+            r.name = name;
+            baseline.push_back(r);
+        }
+    }
+    fclose(in);
+    return baseline;
+}
+
+// Prints each result against its baseline entry, returns how many got
+// slower by more than tolerance
+static int compare(const std::vector<Result>& results, const std::vector<Result>& baseline,
+                   double tolerance) {
+    int regressions = 0;
+    printf("\n%-18s %8s %7s %12s %12s %8s\n", "benchmark", "vehicles", "threads", "baseline", "now", "change");
+    for (const Result& r : results) {
+        for (const Result& b : baseline) {
+            if (b.name != r.name || b.vehicles != r.vehicles || b.threads != r.threads) continue;
+            double change = b.nsPerOp > 0 ? r.nsPerOp / b.nsPerOp - 1 : 0;
+            bool slower = change > tolerance;
+            regressions += slower;
+            printf("%-18s %8ld %7d %12.1f %12.1f %+7.1f%%%s\n", r.name.c_str(), r.vehicles, r.threads,
+                   b.nsPerOp, r.nsPerOp, change * 100, slower ? "  REGRESSION" : "");
+        }
+    }
+    printf("%d regression(s) over %.0f%%\n", regressions, tolerance * 100);
+    return regressions;
+}
+
+int main(int argc, char* argv[]) {
+    std::vector<long> scales = {10, 100, 1000, 10000, 100000};
+    // fixed, so every run covers the rows of the stored baseline
+    std::vector<long> threadCounts = {1, 2, 4};
+    double minTime = 0.2;
+    double tolerance = 0.25;
+    const char* jsonPath = NULL;
+    const char* baselinePath = NULL;
+    for (int i = 1; i + 1 < argc; i += 2) {
+        std::string arg = argv[i];
+        if (arg == "--vehicles") {
+            scales = parseList(argv[i + 1]);
+        } else if (arg == "--threads") {
+            threadCounts = parseList(argv[i + 1]);
+        } else if (arg == "--min-time") {
+            minTime = atof(argv[i + 1]);
+        } else if (arg == "--json") {
+            jsonPath = argv[i + 1];
+        } else if (arg == "--baseline") {
+            baselinePath = argv[i + 1];
+        } else if (arg == "--tolerance") {
+            tolerance = atof(argv[i + 1]);
+        }
+    }
+    rngSeed = 1;
+    TextureCache::instance().build(false);
+
+    std::vector<Result> results;
+    Bench* bench = new Bench();
+    for (long vehicles : scales) {
+        for (long threads : threadCounts) {
+            tickPaths(*bench, results, vehicles, threads, minTime);
+        }
+        spawnAreaClear(*bench, results, vehicles, minTime);
+        challanIngest(results, vehicles, minTime);
+    }
+    delete bench;
+
+    if (jsonPath && !writeJson(jsonPath, results)) return 1;
+    if (baselinePath) {
+        std::vector<Result> baseline = readBaseline(baselinePath);
+        if (compare(results, baseline, tolerance) > 0) return 1;
+    }
+    return 0;
+}
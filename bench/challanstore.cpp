@@ -0,0 +1,71 @@
+#include "../headers/challanstore.h"
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <vector>
+
+// Times the challan store at 1M active challans: insert, id and plate
+// lookups, duplicate checks and settling everything.
+// g++ -O2 bench/challanstore.cpp -o challanstore_bench
+static double secondsSince(std::chrono::steady_clock::time_point start) {
+    return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+static void report(const char* what, long n, double seconds) {
+    printf("%-20s %9ld ops  %8.3f s  %7.1f ns/op\n", what, n, seconds, seconds * 1e9 / n);
+}
+
+int main(int argc, char* argv[]) {
+    const long N = argc > 1 ? atol(argv[1]) : 1000000;
+    ChallanStore store;
+    store.reserve(N);
+
+    std::vector<ChallanEntry> entries(N);
+    for (long i = 0; i < N; i++) {
+        ChallanEntry& e = entries[i];
+        e.id = store.allocateId();
+        snprintf(e.plate, sizeof(e.plate), "Light%ld", i);
+        e.amount = 5850;
+        e.issuedAt = 1700000000 + i;
+        e.dueAt = e.issuedAt + 3 * 24 * 3600;
+        e.isHeavy = 0;
+        e.status = CHALLAN_UNPAID;
+    }
+
+    auto start = std::chrono::steady_clock::now();
+    for (long i = 0; i < N; i++) {
+        store.insert(entries[i]);
+    }
+    report("insert", N, secondsSince(start));
+
+    long found = 0;
+    start = std::chrono::steady_clock::now();
+    for (long i = 0; i < N; i++) {
+        found += store.find(entries[(i * 7919) % N].id) != nullptr;
+    }
+    report("find by id", N, secondsSince(start));
+
+    start = std::chrono::steady_clock::now();
+    for (long i = 0; i < N; i++) {
+        found += store.findByPlate(entries[(i * 7919) % N].plate) != nullptr;
+    }
+    report("find by plate", N, secondsSince(start));
+
+    start = std::chrono::steady_clock::now();
+    for (long i = 0; i < N; i++) {
+        found += store.hasPlate(entries[i].plate);
+    }
+    report("duplicate check", N, secondsSince(start));
+
+    start = std::chrono::steady_clock::now();
+    for (long i = 0; i < N; i++) {
+        store.settle(entries[i].id);
+    }
+    report("settle", N, secondsSince(start));
+
+    if (found != 3 * N || store.size() != 0) {
+        printf("store check failed\n");
+        return 1;
+    }
+    return 0;
+}
@@ -0,0 +1,114 @@
+#include "../headers/ipc.h"
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <algorithm>
+#include <sys/wait.h>
+
+// Encodes N challan records as batch frames and decodes them again, fed
+// in odd sized pieces, checking each record's plate, weight and speed come
+// back as sent. Returns the number of bad records.
+static long batchRoundTrip(long n) {
+    std::string wire;
+    ChallanBatch batch;
+    memset(&batch, 0, sizeof(batch));
+    for (long i = 0; i < n; i++) {
+        ChallanRecord& record = batch.records[batch.count++];
+        snprintf(record.vehicleId, sizeof(record.vehicleId), "%s%ld", i % 3 ? "Light" : "Heavy", i);
+        record.detectedNs = i;
+        record.peakSpeed = 60 + i % 40;
+        record.isHeavy = i % 3 == 0;
+        if (batch.count == ChallanBatch::MAX_RECORDS || i == n - 1) {
+            appendBatchFrame(wire, batch);
+            memset(&batch, 0, sizeof(batch));
+        }
+    }
+
+    FrameDecoder decoder;
+    FrameHeader header;
+    const char* payload;
+    long next = 0, bad = 0;
+    const size_t PIECE = 1000;
+    for (size_t at = 0; at < wire.size(); at += PIECE) {
+        decoder.feed(wire.data() + at, std::min(PIECE, wire.size() - at));
+        while (decoder.next(header, payload)) {
+            uint32_t count = batchRecordCount(header, payload);
+            for (uint32_t i = 0; i < count; i++, next++) {
+                ChallanRecord record;
+                batchRecord(payload, i, record);
+                char plate[32];
+                snprintf(plate, sizeof(plate), "%s%ld", next % 3 ? "Light" : "Heavy", next);
+                if (strcmp(record.vehicleId, plate) != 0 || record.isHeavy != (next % 3 == 0) ||
+                    record.peakSpeed != 60 + next % 40 || record.detectedNs != (uint64_t)next) {
+                    if (bad == 0) {
+                        printf("batch record %ld: plate '%s' heavy %d peak %.0f\n", next,
+                               record.vehicleId, record.isHeavy, record.peakSpeed);
+                    }
+                    bad++;
+                }
+            }
+        }
+    }
+    bad += n - next;  // records that never came out
+    printf("batch records %ld/%ld  bad %ld\n", next, n, bad);
+    return bad;
+}
+
+// Pushes N challan frames through a pipe from a forked writer and decodes
+// them on the other side, checking every id arrives once and in order.
+// The writer flushes in odd sized chunks so frames split across reads.
+// Batch frames get a round trip of their own first.
+// g++ -O2 bench/ipcthroughput.cpp -o ipc_bench
+int main(int argc, char* argv[]) {
+    const long N = argc > 1 ? atol(argv[1]) : 100000;
+    if (batchRoundTrip(N) != 0) return 1;
+    int fds[2];
+    if (pipe(fds) == -1) {
+        perror("pipe");
+        return 1;
+    }
+
+    auto start = std::chrono::steady_clock::now();
+    pid_t pid = fork();
+    if (pid == 0) {
+        close(fds[0]);
+        std::string out;
+        ChallanEntry entry;
+        memset(&entry, 0, sizeof(entry));
+        entry.amount = 5850;
+        for (long i = 1; i <= N; i++) {
+            entry.id = i;
+            snprintf(entry.plate, sizeof(entry.plate), "Light%ld", i);
+            appendFrame(out, IPC_CHALLAN_ISSUED, &entry, sizeof(entry));
+            if (out.size() >= 4093) {
+                writePending(fds[1], out);  // blocking pipe, writes it all
+            }
+        }
+        writePending(fds[1], out);
+        close(fds[1]);
+        _exit(0);
+    }
+    close(fds[1]);
+
+    FrameDecoder decoder;
+    FrameHeader header;
+    const char* payload;
+    uint64_t expected = 1;
+    long mismatched = 0;
+    while (decoder.readFrom(fds[0]) != 0) {
+        while (decoder.next(header, payload)) {
+            ChallanEntry entry;
+            memcpy(&entry, payload, sizeof(entry));
+            if (header.type != IPC_CHALLAN_ISSUED || entry.id != expected) mismatched++;
+            expected++;
+        }
+    }
+    close(fds[0]);
+    waitpid(pid, nullptr, 0);
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+    printf("frames %ld/%ld  errors %ld  out of order %ld\n", decoder.frames, N, decoder.errors, mismatched);
+    printf("%.3f s  %.0f msgs/s\n", seconds, N / seconds);
+    return decoder.frames == N && decoder.errors == 0 && mismatched == 0 ? 0 : 1;
+}
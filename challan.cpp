@@ -1,25 +1,22 @@
 #include <iostream>
 #include <string>
 #include <vector>
+#include <deque>
 #include <ctime>
 #include <iomanip>
+#include <sstream>
+#include <cstring>
 #include <fcntl.h>   
 #include <unistd.h>   
 #include <sys/stat.h> 
+#include <errno.h>
+#include <signal.h>
+#include <sys/ioctl.h>
 #include <SFML/Graphics.hpp>
-
-struct ChallanMessage {
-    char vehicleId[50];
-    float speed;
-    bool isHeavy;
-};
-
-struct ActiveChallan {
-    std::string vehicleId;
-    float amount;
-    std::string issueDate;
-    std::string dueDate;
-};
+#include "headers/ipc.h"
+#include "headers/challanledger.h"
+#include "headers/eventloop.h"
+#include "headers/metrics.h"
 
 class Challan {
 public:
@@ -27,10 +24,44 @@ public:
     sf::Font font; 
     sf::Text totalChallansText; 
     sf::Text currentChallanText; 
-    int totalChallans; 
-    std::vector<ActiveChallan> activeChallans; 
+    sf::Text rateText;
+    ChallanStore activeChallans;  // unpaid challans by id and plate
+    ChallanLedger ledger;         // durable history, rebuilds activeChallans
+
+    static const int LATEST_SHOWN = 8;  // rows in the rolling view
+    std::deque<std::string> latestChallans;
+    long processedThisSecond;  // ingest rate, counted per wall second
+    float challansPerSecond;
+    sf::Clock rateClock;
+    bool dirty;  // something changed since the last frame
+
+    EventLoop loop;
+    LatencyHistogram ingestLatency;  // episode end -> challan issued
+
+    int userPortalFd;  // kept open across challans
+    std::string userPortalBacklog;  // encoded frames waiting for pipe space
+    FrameDecoder challanDecoder;
+    FrameDecoder paymentDecoder;
+
+    // exported through the simulator, see headers/metrics.h
+    Counter issuedMetric;
+    Counter settledMetric;
+    Gauge unpaidMetric;
+    Histogram ingestMetric;
+    Gauge challanFifoMetric;
+    Gauge portalBacklogMetric;
+
+    Challan() : processedThisSecond(0), challansPerSecond(0), dirty(true), userPortalFd(-1) {
+        MetricsRegistry& registry = MetricsRegistry::instance();
+        issuedMetric = registry.counter("challan_issued_total", "Challans issued by the challan process");
+        settledMetric = registry.counter("challan_settled_total", "Challans paid and settled by the challan process");
+        unpaidMetric = registry.gauge("challan_unpaid", "Unpaid challans held by each process", "process=\"challan\"");
+        ingestMetric = registry.histogram("challan_ingest_seconds", "Violation end to challan issued");
+        challanFifoMetric = registry.gauge("fifo_pending_bytes", "Bytes waiting in a FIFO when its reader woke up",
+                                           "fifo=\"challan_fifo\"");
+        portalBacklogMetric = registry.gauge("challan_portal_backlog_bytes",
+                                             "Encoded challans waiting for room in the user portal FIFO");
 
-    Challan() : totalChallans(0) {
         window.create(sf::VideoMode(400, 300), "Challan Tracker");
         window.setPosition({100,700});
         if (!font.loadFromFile("res/CaskaydiaCove.ttf")) {
@@ -43,131 +74,213 @@ public:
         currentChallanText.setFont(font);
         currentChallanText.setCharacterSize(20);
         currentChallanText.setFillColor(sf::Color::Red);
-        currentChallanText.setPosition(0,30);
+        currentChallanText.setPosition(0,60);
+
+        rateText.setFont(font);
+        rateText.setCharacterSize(20);
+        rateText.setFillColor(sf::Color::Black);
+        rateText.setPosition(0,30);
     }
     
-    void calculateFine(bool isHeavy, float& fine, float& serviceCharge) {
-        fine = isHeavy ? 7000.0f : 5000.0f;
-        serviceCharge = fine * 0.17f; // 17% service charge
+    // Whole rupees, 17% service charge on top of the fine
+    void calculateFine(bool isHeavy, int64_t& fine, int64_t& serviceCharge) {
+        fine = isHeavy ? 7000 : 5000;
+        serviceCharge = fine * 17 / 100;
     }
 
-    void setDates(std::string& issueDate, std::string& dueDate) {
-        time_t now = time(0);
-        struct tm* timeinfo = localtime(&now);
-
-        // Issue date
-        issueDate = std::asctime(timeinfo);
-        issueDate.erase(issueDate.length() - 1); 
-
-        // Due date
-        timeinfo->tm_mday += 3; // Add 3 days
-        mktime(timeinfo); 
-        dueDate = std::asctime(timeinfo);
-        dueDate.erase(dueDate.length() - 1); 
+    void setDates(int64_t& issuedAt, int64_t& dueAt) {
+        issuedAt = time(0);
+        dueAt = issuedAt + 3 * 24 * 3600; // Add 3 days
     }
 
     bool isChallanDuplicate(const std::string& vehicleId) {
-        for (const auto& challan : activeChallans) {
-            if (challan.vehicleId == vehicleId) {
-                return true;
-            }
-        }
-        return false;
+        return activeChallans.hasPlate(vehicleId);
     }
 
-    void processChallan(const ChallanMessage& msg) {
+    // Ingest path only: no rendering, no blocking IPC
+    void processChallan(const ChallanRecord& msg) {
+        uint64_t now = monotonicNs();
+        ingestLatency.record(msg.detectedNs, now);
+        ingestMetric.recordNs(now > msg.detectedNs ? now - msg.detectedNs : 0);
         if (isChallanDuplicate(msg.vehicleId)) {
             return; // Ignore duplicate challans
         }
 
-        float fine, serviceCharge;
+        ChallanEntry entry;
+        memset(&entry, 0, sizeof(entry));
+        entry.id = activeChallans.allocateId();
+        snprintf(entry.plate, sizeof(entry.plate), "%s", msg.vehicleId);
+        int64_t fine, serviceCharge;
         calculateFine(msg.isHeavy, fine, serviceCharge);
+        entry.amount = fine + serviceCharge;
+        setDates(entry.issuedAt, entry.dueAt);
+        entry.isHeavy = msg.isHeavy;
+        entry.status = CHALLAN_UNPAID;
+        activeChallans.insert(entry);
+        ledger.append(LEDGER_ISSUE, entry);
+        issuedMetric.add();
+        unpaidMetric.set(activeChallans.size());
+        processedThisSecond++;
+        dirty = true;
 
-        std::string issueDate, dueDate;
-        setDates(issueDate, dueDate);
+        std::stringstream row;
+        row << std::fixed << std::setprecision(1)
+            << msg.vehicleId << "  " << msg.peakSpeed << " km/h  "
+            << msg.overLimitSeconds << " s  " << entry.amount << " PKR";
+        latestChallans.push_front(row.str());
+        if (latestChallans.size() > LATEST_SHOWN) {
+            latestChallans.pop_back();
+        }
 
-        totalChallans++;
+        // Send challan details to UserPortal
+        ChallanIssued issued = {entry, msg.detectedNs};
+        appendFrame(userPortalBacklog, IPC_CHALLAN_ISSUED, &issued, sizeof(issued));
+    }
 
-        currentChallanText.setString("Vehicle ID: " + std::string(msg.vehicleId) +
-                                     "\nAmount: " + std::to_string(fine + serviceCharge) + " PKR");
+    // Writes queued challans to the user portal over one persistent,
+    // non blocking connection. A full pipe is retried when epoll says it
+    // is writable again; a missing portal on the next frame tick.
+    void flushUserPortal() {
+        const char* userPortalFifoPath = "/tmp/userportal_fifo";
+        portalBacklogMetric.set(userPortalBacklog.size());
+        if (userPortalBacklog.empty()) return;
+        if (userPortalFd == -1) {
+            mkfifo(userPortalFifoPath, 0666);
+            userPortalFd = open(userPortalFifoPath, O_WRONLY | O_NONBLOCK);
+            if (userPortalFd == -1) return;  // portal not reading yet
+        }
+        if (!writePending(userPortalFd, userPortalBacklog)) {
+            loop.remove(userPortalFd);
+            close(userPortalFd);  // portal went away
+            userPortalFd = -1;
+        } else if (!userPortalBacklog.empty()) {
+            loop.watchWritable(userPortalFd, [this](int) { flushUserPortal(); });
+        } else {
+            loop.remove(userPortalFd);
+        }
+        portalBacklogMetric.set(userPortalBacklog.size());
+    }
 
-        totalChallansText.setString("Total Challans: " + std::to_string(totalChallans));
+    // Decodes every batch frame that is waiting, true if anything came in
+    bool drainChallans(int fd) {
+        int pending = 0;
+        if (ioctl(fd, FIONREAD, &pending) == 0) challanFifoMetric.set(pending);
+        if (challanDecoder.readFrom(fd) <= 0) return false;
+        FrameHeader header;
+        const char* payload;
+        while (challanDecoder.next(header, payload)) {
+            uint32_t count = batchRecordCount(header, payload);
+            for (uint32_t i = 0; i < count; i++) {
+                ChallanRecord record;
+                batchRecord(payload, i, record);
+                processChallan(record);
+            }
+        }
+        return true;
+    }
 
-        activeChallans.push_back({msg.vehicleId, fine + serviceCharge, issueDate, dueDate});
+    bool drainPayments(int fdPayment) {
+        if (paymentDecoder.readFrom(fdPayment) <= 0) return false;
+        FrameHeader header;
+        const char* payload;
+        while (paymentDecoder.next(header, payload)) {
+            if (header.type != IPC_PAYMENT || header.length != sizeof(PaymentMessage)) continue;
+            PaymentMessage payment;
+            memcpy(&payment, payload, sizeof(payment));
+            if (payment.status != CHALLAN_PAID) continue;
 
-        // Send challan details to UserPortal
-        const char* userPortalFifoPath = "/tmp/userportal_fifo";
-        mkfifo(userPortalFifoPath, 0666);
-        int fd = open(userPortalFifoPath, O_WRONLY);
-        if (fd != -1) {
-            std::string challanDetails = msg.vehicleId; 
-            challanDetails += "," + std::to_string(fine + serviceCharge) + "," + issueDate + "," + dueDate;
-            write(fd, challanDetails.c_str(), challanDetails.size());
-            close(fd);
+            payment.plate[sizeof(payment.plate) - 1] = '\0';
+            const ChallanEntry* found = activeChallans.find(payment.challanId);
+            if (!found) found = activeChallans.findByPlate(payment.plate);
+            if (found) {
+                ChallanEntry paid = *found;
+                paid.status = CHALLAN_PAID;
+                ledger.append(LEDGER_PAY, paid);
+                activeChallans.settle(paid.id);
+                settledMetric.add();
+                unpaidMetric.set(activeChallans.size());
+            }
+        }
+        return true;
+    }
+
+    // Frame tick, 30 times a second: window events, and a redraw of the
+    // latest challans and the ingest rate only when something changed
+    void render() {
+        if (rateClock.getElapsedTime().asSeconds() >= 1.0f) {
+            float rate = processedThisSecond / rateClock.restart().asSeconds();
+            dirty |= rate != challansPerSecond;
+            challansPerSecond = rate;
+            processedThisSecond = 0;
         }
 
-        sf::Clock clock;
         sf::Event e;
-        while (clock.getElapsedTime().asSeconds() < 2) {
-            while(window.pollEvent(e)){
-                if(e.type == sf::Event::Closed){
-                    window.close();
-                    return;
-                }
+        while (window.pollEvent(e)) {
+            if (e.type == sf::Event::Closed) {
+                window.close();
+                loop.stop();
+                return;
             }
-            window.clear(sf::Color::White);
-            window.draw(totalChallansText);
-            window.draw(currentChallanText);
-            window.display();
+            dirty = true;  // resized, exposed, ...
+        }
+        if (!dirty) return;
+        dirty = false;
+
+        totalChallansText.setString("Total Challans: " + std::to_string(activeChallans.size()));
+        std::stringstream rate;
+        rate << std::fixed << std::setprecision(1) << "Rate: " << challansPerSecond << " /s";
+        rateText.setString(rate.str());
+        std::string latest;
+        for (const auto& row : latestChallans) {
+            latest += row + "\n";
         }
+        currentChallanText.setString(latest);
+
+        window.clear(sf::Color::White);
+        window.draw(totalChallansText);
+        window.draw(rateText);
+        window.draw(currentChallanText);
+        window.display();
     }
 
     void run() {
+        if (ledger.open("challan.ledger", activeChallans)) {
+            std::cout << "Ledger: " << ledger.recovered << " records, " << activeChallans.size()
+                      << " unpaid, rebuilt in " << ledger.recoveryMs << " ms" << std::endl;
+        } else {
+            std::cerr << "Failed to open challan.ledger, challans will not survive a restart." << std::endl;
+        }
+        unpaidMetric.set(activeChallans.size());
+
         const char* fifoPath = "/tmp/challan_fifo";
         const char* paymentFifoPath = "/tmp/challan_payment_fifo";
 
-        mkfifo(fifoPath, 0666);
-        mkfifo(paymentFifoPath, 0666);
-
-        int fd = open(fifoPath, O_RDONLY | O_NONBLOCK);
-        int fdPayment = open(paymentFifoPath, O_RDONLY | O_NONBLOCK);
+        signal(SIGPIPE, SIG_IGN);  // closed portal shows up as EPIPE
 
+        int fd = loop.watchFifo(fifoPath, [this](int fd) {
+            drainChallans(fd);
+            flushUserPortal();
+        });
+        int fdPayment = loop.watchFifo(paymentFifoPath, [this](int fd) {
+            if (drainPayments(fd)) dirty = true;
+        });
         if (fd == -1 || fdPayment == -1) {
             std::cerr << "Failed to open FIFO for reading." << std::endl;
             return;
         }
+        loop.addTimer(33, [this](int) {
+            flushUserPortal();
+            ledger.syncIfDue();
+            render();
+        });
 
-        ChallanMessage msg;
-        char paymentBuffer[256];
-        while (true) {
-            int bytesRead = read(fd, &msg, sizeof(msg));
-            if (bytesRead == sizeof(msg)) {
-                processChallan(msg);
-            }
-
-            int paymentBytesRead = read(fdPayment, paymentBuffer, sizeof(paymentBuffer));
-            if (paymentBytesRead > 0) {
-                paymentBuffer[paymentBytesRead] = '\0';
-                std::string paymentStatus(paymentBuffer);
-                std::istringstream iss(paymentStatus);
-                std::string challanId, vehicleNumber, status;
-                std::getline(iss, challanId, ',');
-                std::getline(iss, vehicleNumber, ',');
-                std::getline(iss, status, ',');
-
-                if (status == "Paid") {
-                    activeChallans.erase(std::remove_if(activeChallans.begin(), activeChallans.end(),
-                        [&vehicleNumber](const ActiveChallan& c) { return c.vehicleId == vehicleNumber; }),
-                        activeChallans.end());
-                    totalChallans--;
-                }
-            }
-
-            usleep(100000); 
-        }
+        loop.run();
 
-        close(fd);
-        close(fdPayment);
+        ledger.sync();
+        if (userPortalFd != -1) close(userPortalFd);
+        ingestLatency.print("Violation to challan");
+        std::cout << "Event loop: " << loop.wakeups << " wakeups, "
+                  << loop.rearms << " FIFO re-arms" << std::endl;
     }
 };
 
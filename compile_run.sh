@@ -30,6 +30,22 @@ else
     exit
 fi
 
+# batch IDM kernel must match the scalar formula bit for bit
+if $compiler "bench/idmcheck.cpp" $cmd -ffp-contract=off -o idmcheck && ./idmcheck; then
+    echo "IDM batch check passed"
+else
+    echo "IDM batch check failed"
+    exit 1
+fi
+
+if $compiler "headless.cpp" $cmd -o traffic_headless $libs; then
+    clear
+    echo "Compilation successful of headless"
+else
+    echo "Compilation failed headless"
+    exit
+fi
+
 if $compiler $files $cmd -o $out $libs; then
     clear
     echo "Compilation successful of main"
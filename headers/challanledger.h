@@ -0,0 +1,232 @@
+#ifndef CHALLANLEDGER_H
+#define CHALLANLEDGER_H
+
+#include "challanstore.h"
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <time.h>
+
+enum LedgerEvent : uint16_t {
+    LEDGER_ISSUE = 1,
+    LEDGER_PAY,
+    LEDGER_VOID
+};
+
+struct LedgerHeader {
+    char magic[8];  // "STXLEDG1"
+    uint32_t version;
+    uint32_t recordSize;
+    uint8_t reserved[48];
+};
+
+// Fixed size so recovery can step through the file without parsing
+struct LedgerRecord {
+    uint32_t crc;  // crc32 of everything after this field
+    uint16_t type;  // LedgerEvent
+    uint16_t reserved;
+    uint64_t seq;  // 1, 2, 3... a gap means the tail is torn
+    ChallanEntry entry;
+};
+
+inline uint32_t ledgerCrc32(const void* data, size_t size) {
+    static uint32_t table[256];
+    static bool ready = false;
+    if (!ready) {
+        for (uint32_t i = 0; i < 256; i++) {
+            uint32_t c = i;
+            for (int k = 0; k < 8; k++) {
+                c = (c & 1) ? 0xEDB88320u ^ (c >> 1) : c >> 1;
+            }
+            table[i] = c;
+        }
+        ready = true;
+    }
+    const uint8_t* p = (const uint8_t*)data;
+    uint32_t crc = 0xFFFFFFFFu;
+    for (size_t i = 0; i < size; i++) {
+        crc = table[(crc ^ p[i]) & 0xFF] ^ (crc >> 8);
+    }
+    return crc ^ 0xFFFFFFFFu;
+}
+
+// Append only, memory mapped record of every issue, payment and void.
+// Appends are memcpy into the mapping; msync runs once per GROUP_COMMIT
+// records or SYNC_INTERVAL_MS, whichever comes first. On open the file is
+// scanned up to the first record with a bad checksum or sequence number,
+// which is where a crash left the tail, and appends continue from there.
+class ChallanLedger {
+public:
+    static const int GROUP_COMMIT = 64;
+    static const int SYNC_INTERVAL_MS = 50;
+    static const size_t INITIAL_SIZE = 1 << 20;
+
+    long recovered;     // valid records found on open
+    long tornBytes;     // bytes past the last valid record
+    double recoveryMs;  // time to scan and replay on open
+
+private:
+    int fd;
+    char* base;
+    size_t mappedSize;
+    size_t tail;  // offset of the next record
+    uint64_t nextSeq;
+    size_t syncedUpTo;
+    int pending;  // records appended since the last sync
+    struct timespec lastSync;
+
+    LedgerRecord* recordAt(size_t offset) const {
+        return (LedgerRecord*)(base + offset);
+    }
+
+    static uint32_t checksum(const LedgerRecord& record) {
+        return ledgerCrc32((const char*)&record + sizeof(record.crc),
+                           sizeof(record) - sizeof(record.crc));
+    }
+
+    static double msSince(const struct timespec& start) {
+        struct timespec now;
+        clock_gettime(CLOCK_MONOTONIC, &now);
+        return (now.tv_sec - start.tv_sec) * 1000.0 + (now.tv_nsec - start.tv_nsec) / 1e6;
+    }
+
+    bool map(size_t size) {
+        if (base) munmap(base, mappedSize);
+        base = (char*)mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+        if (base == MAP_FAILED) {
+            base = nullptr;
+            return false;
+        }
+        mappedSize = size;
+        return true;
+    }
+
+    bool grow() {
+        size_t size = mappedSize * 2;
+        sync();
+        if (ftruncate(fd, size) != 0) return false;
+        return map(size);
+    }
+
+public:
+    ChallanLedger() : recovered(0), tornBytes(0), recoveryMs(0), fd(-1), base(nullptr),
+                      mappedSize(0), tail(sizeof(LedgerHeader)), nextSeq(1),
+                      syncedUpTo(0), pending(0) {}
+
+    ChallanLedger(const ChallanLedger&) = delete;
+    ChallanLedger& operator=(const ChallanLedger&) = delete;
+
+    // Maps the file (creating it if needed), finds the valid tail and
+    // rebuilds store from the records. False if the file is unusable.
+    bool open(const char* path, ChallanStore& store) {
+        struct timespec start;
+        clock_gettime(CLOCK_MONOTONIC, &start);
+
+        fd = ::open(path, O_RDWR | O_CREAT, 0644);
+        if (fd == -1) return false;
+
+        struct stat st;
+        fstat(fd, &st);
+        size_t size = st.st_size;
+        bool fresh = size < sizeof(LedgerHeader);
+        if (size < INITIAL_SIZE) {
+            if (ftruncate(fd, INITIAL_SIZE) != 0) return false;
+            size = INITIAL_SIZE;
+        }
+        if (!map(size)) return false;
+
+        LedgerHeader* header = (LedgerHeader*)base;
+        if (fresh) {
+            memset(header, 0, sizeof(*header));
+            memcpy(header->magic, "STXLEDG1", 8);
+            header->version = 1;
+            header->recordSize = sizeof(LedgerRecord);
+            msync(base, sizeof(*header), MS_SYNC);
+        } else if (memcmp(header->magic, "STXLEDG1", 8) != 0 ||
+                   header->recordSize != sizeof(LedgerRecord)) {
+            return false;
+        }
+
+        // replay until the first record that was not completely written
+        tail = sizeof(LedgerHeader);
+        while (tail + sizeof(LedgerRecord) <= mappedSize) {
+            const LedgerRecord& record = *recordAt(tail);
+            if (record.seq != nextSeq || record.crc != checksum(record)) break;
+            if (record.type == LEDGER_ISSUE) {
+                store.insert(record.entry);
+            } else {
+                store.settle(record.entry.id);
+                store.noteId(record.entry.id);
+            }
+            nextSeq++;
+            tail += sizeof(LedgerRecord);
+        }
+        recovered = nextSeq - 1;
+
+        // wipe a torn tail so a later partial scan cannot mistake it
+        size_t end = tail;
+        while (end + sizeof(LedgerRecord) <= mappedSize && recordAt(end)->seq != 0) {
+            end += sizeof(LedgerRecord);
+        }
+        tornBytes = end - tail;
+        if (tornBytes) {
+            memset(base + tail, 0, tornBytes);
+            msync(base, mappedSize, MS_SYNC);
+        }
+
+        syncedUpTo = tail;
+        clock_gettime(CLOCK_MONOTONIC, &lastSync);
+        recoveryMs = msSince(start);
+        return true;
+    }
+
+    bool append(LedgerEvent type, const ChallanEntry& entry) {
+        if (!base) return false;
+        if (tail + sizeof(LedgerRecord) > mappedSize && !grow()) return false;
+
+        LedgerRecord record;
+        memset(&record, 0, sizeof(record));
+        record.type = type;
+        record.seq = nextSeq++;
+        record.entry = entry;
+        record.crc = checksum(record);
+        memcpy(base + tail, &record, sizeof(record));
+        tail += sizeof(record);
+
+        if (++pending >= GROUP_COMMIT) {
+            sync();
+        }
+        return true;
+    }
+
+    // Group commit on a timer, call from the service's idle path
+    void syncIfDue() {
+        if (pending && msSince(lastSync) >= SYNC_INTERVAL_MS) {
+            sync();
+        }
+    }
+
+    // Flushes every record appended since the last sync to disk
+    void sync() {
+        if (!base || syncedUpTo == tail) return;
+        size_t page = sysconf(_SC_PAGESIZE);
+        size_t from = syncedUpTo / page * page;
+        msync(base + from, tail - from, MS_SYNC);
+        syncedUpTo = tail;
+        pending = 0;
+        clock_gettime(CLOCK_MONOTONIC, &lastSync);
+    }
+
+    long records() const {
+        return nextSeq - 1;
+    }
+
+    ~ChallanLedger() {
+        sync();
+        if (base) munmap(base, mappedSize);
+        if (fd != -1) close(fd);
+    }
+};
+
+#endif
@@ -0,0 +1,229 @@
+#ifndef CHALLANOUTBOX_H
+#define CHALLANOUTBOX_H
+
+#include <atomic>
+#include <pthread.h>
+#include <semaphore.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <poll.h>
+#include <signal.h>
+#include <errno.h>
+#include <time.h>
+#include <sys/stat.h>
+#include <cstdio>
+#include "ipc.h"
+
+// What to do with a challan when the outbox is full
+enum OutboxPolicy {
+    OUTBOX_DROP = 0,  // count it and forget it
+    OUTBOX_BLOCK,     // wait for the writer to make room
+    OUTBOX_SPILL      // append it to a local file instead
+};
+
+// Bounded single producer / single consumer queue of challan batches
+// between violation detection and a writer thread that owns one persistent connection to
+// the challan FIFO. enqueue() never touches the FIFO, so a slow or
+// missing challan process cannot stall the simulation.
+class ChallanOutbox {
+public:
+    static const int CAPACITY = 256;  // batches, power of two
+    static const int DRAIN_MS = 1000;  // stop() waits this long for the reader
+
+    // all counted in batches. Every batch handed to enqueue() ends up in
+    // exactly one of sent, dropped or spilled once stop() returns.
+    std::atomic<long> queued;   // accepted into the queue
+    std::atomic<long> sent;     // written to the FIFO
+    std::atomic<long> dropped;  // lost to a full queue (OUTBOX_DROP)
+    std::atomic<long> spilled;  // written to the spill file instead
+
+private:
+    ChallanBatch ring[CAPACITY];
+    std::atomic<unsigned> head;  // next to send, consumer side
+    std::atomic<unsigned> tail;  // next free, producer side
+    sem_t available;             // posted once per queued message
+
+    OutboxPolicy policy;
+    const char* fifoPath;
+    const char* spillPath;
+    FILE* spillFile;
+
+    std::string frame;  // writer thread's encode buffer, reused
+
+    pthread_t writerThread;
+    std::atomic<bool> running;
+    bool started;
+    int fd;
+
+    bool connect() {
+        if (fd != -1) return true;
+        mkfifo(fifoPath, 0666);
+        // non blocking open fails with ENXIO until the reader is up
+        fd = open(fifoPath, O_WRONLY | O_NONBLOCK);
+        return fd != -1;
+    }
+
+    void disconnect() {
+        if (fd != -1) {
+            close(fd);
+            fd = -1;
+        }
+    }
+
+    // Writes one whole batch, waiting on poll() while the pipe is full.
+    // False if the reader went away; the batch is retried after reconnect.
+    // Gives up once stopped, or after deadlineNs when draining.
+    bool writeBatch(const ChallanBatch& batch, uint64_t deadlineNs = 0) {
+        frame.clear();
+        appendBatchFrame(frame, batch);
+        while (running || monotonicNs() < deadlineNs) {
+            // under PIPE_BUF, so the pipe takes all of it or none
+            ssize_t n = write(fd, frame.data(), frame.size());
+            if (n == (ssize_t)frame.size()) return true;
+            if (n == -1 && errno == EAGAIN) {
+                struct pollfd p = {fd, POLLOUT, 0};
+                poll(&p, 1, 100);
+                continue;
+            }
+            disconnect();  // EPIPE, reader closed its end
+            return false;
+        }
+        return false;
+    }
+
+    static void* writerLoop(void* arg) {
+        ChallanOutbox* outbox = (ChallanOutbox*)arg;
+        while (outbox->running) {
+            struct timespec deadline;
+            clock_gettime(CLOCK_REALTIME, &deadline);
+            deadline.tv_nsec += 100 * 1000000;
+            if (deadline.tv_nsec >= 1000000000) {
+                deadline.tv_sec++;
+                deadline.tv_nsec -= 1000000000;
+            }
+            if (sem_timedwait(&outbox->available, &deadline) != 0) {
+                continue;  // timeout, recheck running
+            }
+
+            // keep the batch queued until it is really written
+            unsigned h = outbox->head.load(std::memory_order_relaxed);
+            const ChallanBatch& batch = outbox->ring[h % CAPACITY];
+            while (outbox->running && !(outbox->connect() && outbox->writeBatch(batch))) {
+                usleep(100000);  // challan process not there yet
+            }
+            if (!outbox->running) break;
+            outbox->head.store(h + 1, std::memory_order_release);
+            outbox->sent++;
+        }
+        outbox->drain();
+        outbox->disconnect();
+        return NULL;
+    }
+
+    // After stop(): sends what the reader still takes within DRAIN_MS and
+    // spills the rest, so nothing queued is lost silently on shutdown
+    void drain() {
+        uint64_t deadline = monotonicNs() + DRAIN_MS * 1000000ull;
+        unsigned h = head.load(std::memory_order_relaxed);
+        unsigned t = tail.load(std::memory_order_acquire);
+        for (; h != t; h++) {
+            const ChallanBatch& batch = ring[h % CAPACITY];
+            if (monotonicNs() < deadline && connect() && writeBatch(batch, deadline)) {
+                sent++;
+            } else {
+                spill(batch);  // counts as spilled, or dropped if the file fails
+            }
+            head.store(h + 1, std::memory_order_release);
+        }
+    }
+
+    void spill(const ChallanBatch& batch) {
+        if (!spillFile) {
+            spillFile = fopen(spillPath, "a");
+            if (!spillFile) {
+                dropped++;
+                return;
+            }
+        }
+        for (uint32_t i = 0; i < batch.count; i++) {
+            const ChallanRecord& r = batch.records[i];
+            fprintf(spillFile, "%s,%.1f,%.2f,%s\n", r.vehicleId, r.peakSpeed,
+                    r.overLimitSeconds, r.isHeavy ? "Heavy" : "Light");
+        }
+        fflush(spillFile);
+        spilled++;
+    }
+
+public:
+    ChallanOutbox(OutboxPolicy policy = OUTBOX_SPILL,
+                  const char* fifoPath = "/tmp/challan_fifo",
+                  const char* spillPath = "challan_spill.log")
+        : queued(0), sent(0), dropped(0), spilled(0), head(0), tail(0),
+          policy(policy), fifoPath(fifoPath), spillPath(spillPath), spillFile(nullptr),
+          running(false), started(false), fd(-1) {
+        sem_init(&available, 0, 0);
+    }
+
+    ChallanOutbox(const ChallanOutbox&) = delete;
+    ChallanOutbox& operator=(const ChallanOutbox&) = delete;
+
+    void setPolicy(OutboxPolicy newPolicy) {
+        policy = newPolicy;
+    }
+
+    void start() {
+        if (started) return;
+        signal(SIGPIPE, SIG_IGN);  // a closed reader shows up as EPIPE instead
+        running = true;
+        started = true;
+        pthread_create(&writerThread, NULL, writerLoop, this);
+    }
+
+    // Called by violation detection only, never blocks unless the policy
+    // is OUTBOX_BLOCK and the queue is full. Without a running writer
+    // nothing would ever leave the queue, so the batch is handled as if
+    // it were full and OUTBOX_BLOCK counts it as dropped instead of waiting.
+    void enqueue(const ChallanBatch& batch) {
+        unsigned t = tail.load(std::memory_order_relaxed);
+        while (!running || t - head.load(std::memory_order_acquire) >= CAPACITY) {
+            if (policy == OUTBOX_SPILL) {
+                spill(batch);
+                return;
+            }
+            if (policy == OUTBOX_DROP || !running) {
+                dropped++;
+                return;
+            }
+            usleep(1000);  // OUTBOX_BLOCK
+        }
+        ring[t % CAPACITY] = batch;
+        tail.store(t + 1, std::memory_order_release);
+        queued++;
+        sem_post(&available);
+    }
+
+    int depth() const {
+        return tail.load() - head.load();
+    }
+
+    void printStats() const {
+        std::printf("Challan outbox: queued %ld, sent %ld, dropped %ld, spilled %ld, pending %d\n",
+                    queued.load(), sent.load(), dropped.load(), spilled.load(), depth());
+    }
+
+    // Joins the writer once it has drained the queue, see drain()
+    void stop() {
+        if (!started) return;
+        running = false;
+        pthread_join(writerThread, NULL);
+        started = false;
+    }
+
+    ~ChallanOutbox() {
+        stop();
+        if (spillFile) fclose(spillFile);
+        sem_destroy(&available);
+    }
+};
+
+#endif
@@ -0,0 +1,30 @@
+#ifndef CHALLANPROTOCOL_H
+#define CHALLANPROTOCOL_H
+
+#include <stdint.h>
+
+// Challan records the simulation sends to challan.cpp, framed by ipc.h
+
+// One speeding episode of one vehicle, sent when the episode ends
+// (speed back under the limit or the vehicle left the screen)
+struct ChallanRecord {
+    char vehicleId[32];
+    uint64_t detectedNs;     // CLOCK_MONOTONIC when the episode ended
+    float peakSpeed;         // highest speed seen while over the limit
+    float overLimitSeconds;  // time spent over the limit
+    uint8_t isHeavy;
+};
+
+// All episodes that ended in one traffic tick. Only count and the used
+// records are sent, as one IPC_CHALLAN_BATCH frame (see ipc.h); a full
+// frame stays under PIPE_BUF, so each write lands in the pipe whole.
+struct ChallanBatch {
+    static const int MAX_RECORDS = 32;
+
+    uint32_t count;
+    ChallanRecord records[MAX_RECORDS];
+};
+
+static_assert(sizeof(ChallanBatch) + 8 <= 4096, "a ChallanBatch frame must fit in PIPE_BUF");
+
+#endif
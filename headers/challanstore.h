@@ -0,0 +1,103 @@
+#ifndef CHALLANSTORE_H
+#define CHALLANSTORE_H
+
+#include <stdint.h>
+#include <string.h>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+
+enum ChallanStatus : uint8_t {
+    CHALLAN_UNPAID = 0,
+    CHALLAN_PAID,
+    CHALLAN_VOID
+};
+
+struct ChallanEntry {
+    uint64_t id;
+    char plate[32];
+    int64_t amount;    // PKR, fine plus service charge
+    int64_t issuedAt;  // epoch seconds
+    int64_t dueAt;     // epoch seconds
+    uint8_t isHeavy;
+    uint8_t status;
+};
+
+// Active (unpaid) challans keyed by challan id, with a vehicle plate
+// index on the side. Insert, lookup and settle are all O(1) average.
+// Used by both the challan service and the user portal.
+class ChallanStore {
+private:
+    std::unordered_map<uint64_t, ChallanEntry> byId;
+    // plate -> id, keys point at the plate inside the byId node, which
+    // stays put until that entry is erased
+    std::unordered_map<std::string_view, uint64_t> byPlate;
+    uint64_t nextId;
+
+public:
+    ChallanStore() : nextId(1) {}
+
+    void reserve(size_t n) {
+        byId.reserve(n);
+        byPlate.reserve(n);
+    }
+
+    // Next free id, for the service that issues challans
+    uint64_t allocateId() {
+        return nextId++;
+    }
+
+    // Keeps allocateId() past ids that are no longer active
+    void noteId(uint64_t id) {
+        if (id >= nextId) nextId = id + 1;
+    }
+
+    // False if the id or the plate already has an active challan
+    bool insert(const ChallanEntry& entry) {
+        if (byId.count(entry.id) || byPlate.count(entry.plate)) {
+            return false;
+        }
+        const ChallanEntry& stored = byId.emplace(entry.id, entry).first->second;
+        byPlate.emplace(std::string_view(stored.plate), entry.id);
+        noteId(entry.id);
+        return true;
+    }
+
+    const ChallanEntry* find(uint64_t id) const {
+        auto it = byId.find(id);
+        return it == byId.end() ? nullptr : &it->second;
+    }
+
+    const ChallanEntry* findByPlate(std::string_view plate) const {
+        auto it = byPlate.find(plate);
+        return it == byPlate.end() ? nullptr : find(it->second);
+    }
+
+    bool hasPlate(std::string_view plate) const {
+        return byPlate.count(plate) != 0;
+    }
+
+    // Marks a challan paid and drops it from the active set
+    bool settle(uint64_t id) {
+        auto it = byId.find(id);
+        if (it == byId.end()) return false;
+        byPlate.erase(std::string_view(it->second.plate));
+        byId.erase(it);
+        return true;
+    }
+
+    bool settleByPlate(std::string_view plate) {
+        auto it = byPlate.find(plate);
+        return it != byPlate.end() && settle(it->second);
+    }
+
+    size_t size() const {
+        return byId.size();
+    }
+
+    const std::unordered_map<uint64_t, ChallanEntry>& entries() const {
+        return byId;
+    }
+};
+
+#endif
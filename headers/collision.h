@@ -0,0 +1,235 @@
+#ifndef COLLISION_H
+#define COLLISION_H
+
+#include "vehicle.h"
+#include <cmath>
+#include <stdint.h>
+
+// A pair of vehicles from different directions that started overlapping
+struct CollisionEvent {
+    uint32_t tick;
+    unsigned char directionA, directionB;
+    int slotA, slotB;
+    float x, y;  // midpoint of the two centres
+    char plateA[24];
+    char plateB[24];
+};
+
+// Cross-direction collision detection, run once a tick after every lane
+// has moved. Broad phase bins vehicles near the intersection box into a
+// uniform grid; narrow phase runs a separating axis test on the oriented
+// boxes of pairs sharing a cell. A pair is only tested in the cell that
+// holds the corner where their bounding boxes start to overlap, so pairs
+// spanning several cells are tested once.
+//
+// FLAG_COLLISION is set while a vehicle overlaps another and cleared once
+// it is free. Overlapping pairs are kept per tick, and an event is raised
+// for a pair that did not overlap on the previous tick, even when both
+// vehicles were already overlapping someone else.
+class CollisionDetector {
+public:
+    static const int DIRECTIONS = 4;
+    static const int BODIES = DIRECTIONS * VehicleTable::CAPACITY;
+    static const int CELL_SIZE = 32;       // about half a car length
+    static const int MARGIN = 64;          // around the box, catches vehicles entering it
+    static const int CELL_CAPACITY = 16;
+    static const int MAX_EVENTS = 64;      // per tick
+    static const int PAIR_WORDS = (BODIES * BODIES + 63) / 64;
+
+    CollisionEvent events[MAX_EVENTS];  // this tick's new collisions
+    int eventCount;
+    long totalEvents;
+    long pairsTested;
+    long cellOverflows;  // bodies that did not fit a cell, not tested there
+
+private:
+    // Oriented box of one vehicle, axis is the unit vector along its length
+    struct Body {
+        float cx, cy;
+        float ax, ay;
+        float halfLength, halfWidth;
+        float minX, minY, maxX, maxY;
+    };
+
+    struct Cell {
+        int count;
+        uint16_t bodies[CELL_CAPACITY];
+    };
+
+    float originX, originY;
+    int cols, rows;
+    Cell* cells;
+    Body bodies[BODIES];
+    bool binned[BODIES];
+    bool hit[BODIES];
+    // bit a * BODIES + b (a < b) per overlapping pair, this tick and last
+    uint64_t pairs[2][PAIR_WORDS];
+    int current;
+    float axisX[DIRECTIONS], axisY[DIRECTIONS];
+
+    int cellX(float x) const {
+        int c = (int)((x - originX) / CELL_SIZE);
+        return c < 0 ? 0 : (c >= cols ? cols - 1 : c);
+    }
+
+    int cellY(float y) const {
+        int r = (int)((y - originY) / CELL_SIZE);
+        return r < 0 ? 0 : (r >= rows ? rows - 1 : r);
+    }
+
+    // Separating axis test on the two boxes' own axes
+    static bool overlaps(const Body& a, const Body& b) {
+        float dx = b.cx - a.cx, dy = b.cy - a.cy;
+        const Body* boxes[2] = {&a, &b};
+        for (const Body* box : boxes) {
+            // the box's length axis and its perpendicular
+            float axes[2][2] = {{box->ax, box->ay}, {-box->ay, box->ax}};
+            for (auto& axis : axes) {
+                float distance = std::fabs(dx * axis[0] + dy * axis[1]);
+                float ra = a.halfLength * std::fabs(a.ax * axis[0] + a.ay * axis[1]) +
+                           a.halfWidth * std::fabs(-a.ay * axis[0] + a.ax * axis[1]);
+                float rb = b.halfLength * std::fabs(b.ax * axis[0] + b.ay * axis[1]) +
+                           b.halfWidth * std::fabs(-b.ay * axis[0] + b.ax * axis[1]);
+                if (distance > ra + rb) return false;
+            }
+        }
+        return true;
+    }
+
+    void raise(const VehicleTable* tables, int a, int b, uint32_t tick) {
+        totalEvents++;
+        if (eventCount == MAX_EVENTS) return;
+        CollisionEvent& event = events[eventCount++];
+        const VehicleTable& tableA = tables[a / VehicleTable::CAPACITY];
+        const VehicleTable& tableB = tables[b / VehicleTable::CAPACITY];
+        int slotA = a % VehicleTable::CAPACITY, slotB = b % VehicleTable::CAPACITY;
+        event.tick = tick;
+        event.directionA = tableA.direction;
+        event.directionB = tableB.direction;
+        event.slotA = slotA;
+        event.slotB = slotB;
+        event.x = (bodies[a].cx + bodies[b].cx) / 2;
+        event.y = (bodies[a].cy + bodies[b].cy) / 2;
+        snprintf(event.plateA, sizeof(event.plateA), "%s", tableA.numberPlate[slotA]);
+        snprintf(event.plateB, sizeof(event.plateB), "%s", tableB.numberPlate[slotB]);
+    }
+
+public:
+    CollisionDetector() : eventCount(0), totalEvents(0), pairsTested(0), cellOverflows(0),
+                          pairs(), current(0) {
+        intersectionBox box;
+        originX = box.top.x - MARGIN;
+        originY = box.top.y - MARGIN;
+        cols = (int)(box.dim.x + 2 * MARGIN) / CELL_SIZE + 1;
+        rows = (int)(box.dim.y + 2 * MARGIN) / CELL_SIZE + 1;
+        cells = new Cell[cols * rows];
+        for (int d = 0; d < DIRECTIONS; d++) {
+            // sprites are drawn nose up, rotation turns them to the heading
+            float radians = SPAWN_POINTS[d].rotation * 3.14159265f / 180.0f;
+            axisX[d] = std::round(std::sin(radians) * 1e6f) / 1e6f;
+            axisY[d] = std::round(-std::cos(radians) * 1e6f) / 1e6f;
+        }
+    }
+
+    ~CollisionDetector() {
+        delete[] cells;
+    }
+
+    // tables holds the four directions in order
+    void detect(VehicleTable* tables, uint32_t tick) {
+        eventCount = 0;
+        current ^= 1;
+        uint64_t* now = pairs[current];
+        const uint64_t* before = pairs[current ^ 1];
+        for (int i = 0; i < PAIR_WORDS; i++) {
+            now[i] = 0;
+        }
+        for (int i = 0; i < cols * rows; i++) {
+            cells[i].count = 0;
+        }
+        float regionMaxX = originX + cols * CELL_SIZE;
+        float regionMaxY = originY + rows * CELL_SIZE;
+
+        // broad phase: bin every vehicle near the box into the cells its
+        // bounding box covers
+        for (int d = 0; d < DIRECTIONS; d++) {
+            VehicleTable& table = tables[d];
+            for (int slot = 0; slot < VehicleTable::CAPACITY; slot++) {
+                int id = d * VehicleTable::CAPACITY + slot;
+                binned[id] = false;
+                if (!table.alive(slot)) continue;
+
+                const sf::IntRect& rect = TextureCache::instance().rect(table.skin[slot]);
+                Body& body = bodies[id];
+                body.cx = table.posX[slot];
+                body.cy = table.posY[slot];
+                body.ax = axisX[d];
+                body.ay = axisY[d];
+                body.halfLength = rect.height / 2.0f;
+                body.halfWidth = rect.width / 2.0f;
+                float extentX = std::fabs(body.ax) * body.halfLength + std::fabs(body.ay) * body.halfWidth;
+                float extentY = std::fabs(body.ay) * body.halfLength + std::fabs(body.ax) * body.halfWidth;
+                body.minX = body.cx - extentX;
+                body.maxX = body.cx + extentX;
+                body.minY = body.cy - extentY;
+                body.maxY = body.cy + extentY;
+
+                if (body.maxX < originX || body.minX > regionMaxX ||
+                    body.maxY < originY || body.minY > regionMaxY) {
+                    table.flags[slot] &= ~FLAG_COLLISION;  // far from the box
+                    continue;
+                }
+                binned[id] = true;
+                hit[id] = false;
+                for (int r = cellY(body.minY); r <= cellY(body.maxY); r++) {
+                    for (int c = cellX(body.minX); c <= cellX(body.maxX); c++) {
+                        Cell& cell = cells[r * cols + c];
+                        if (cell.count == CELL_CAPACITY) {
+                            cellOverflows++;
+                            continue;
+                        }
+                        cell.bodies[cell.count++] = id;
+                    }
+                }
+            }
+        }
+
+        // narrow phase, pairs from different directions only: vehicles of
+        // one lane are kept apart by car following
+        for (int r = 0; r < rows; r++) {
+            for (int c = 0; c < cols; c++) {
+                const Cell& cell = cells[r * cols + c];
+                for (int i = 0; i < cell.count; i++) {
+                    int a = cell.bodies[i];
+                    for (int j = i + 1; j < cell.count; j++) {
+                        int b = cell.bodies[j];
+                        if (a / VehicleTable::CAPACITY == b / VehicleTable::CAPACITY) continue;
+                        const Body& bodyA = bodies[a];
+                        const Body& bodyB = bodies[b];
+                        if (bodyA.maxX < bodyB.minX || bodyB.maxX < bodyA.minX ||
+                            bodyA.maxY < bodyB.minY || bodyB.maxY < bodyA.minY) continue;
+                        // owner cell of the pair
+                        if (cellX(std::max(bodyA.minX, bodyB.minX)) != c ||
+                            cellY(std::max(bodyA.minY, bodyB.minY)) != r) continue;
+                        pairsTested++;
+                        if (!overlaps(bodyA, bodyB)) continue;
+
+                        int pair = std::min(a, b) * BODIES + std::max(a, b);
+                        uint64_t bit = 1ULL << (pair % 64);
+                        now[pair / 64] |= bit;
+                        if (!(before[pair / 64] & bit)) raise(tables, a, b, tick);
+                        hit[a] = hit[b] = true;
+                    }
+                }
+            }
+        }
+
+        for (int id = 0; id < BODIES; id++) {
+            if (!binned[id]) continue;
+            unsigned char& flags = tables[id / VehicleTable::CAPACITY].flags[id % VehicleTable::CAPACITY];
+            flags = hit[id] ? (flags | FLAG_COLLISION) : (flags & ~FLAG_COLLISION);
+        }
+    }
+};
+
+#endif
@@ -0,0 +1,172 @@
+#ifndef EVENTLOOP_H
+#define EVENTLOOP_H
+
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/timerfd.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <errno.h>
+#include <stdint.h>
+#include <functional>
+#include <string>
+#include <unordered_map>
+
+// Single threaded epoll loop for the challan and userportal services.
+// The process sleeps in epoll_wait until a FIFO is readable, a timer
+// (UI frame) is due or stop() is called, so idle services use no CPU and
+// a message is handled as soon as it lands in the pipe.
+class EventLoop {
+public:
+    typedef std::function<void(int fd)> Handler;
+
+    long wakeups;  // epoll_wait returns
+    long rearms;   // FIFOs reopened after their writer hung up
+
+private:
+    struct Watch {
+        Handler onReady;
+        std::string fifoPath;  // set for FIFOs reopened on hangup
+        bool timer;
+    };
+
+    int epollFd;
+    int stopFd;  // eventfd, written by stop()
+    bool running;
+    std::unordered_map<int, Watch> watches;
+
+    bool add(int fd, uint32_t events, const Watch& watch) {
+        epoll_event event = {};
+        event.events = events;
+        event.data.fd = fd;
+        if (epoll_ctl(epollFd, EPOLL_CTL_ADD, fd, &event) == -1) return false;
+        watches[fd] = watch;
+        return true;
+    }
+
+    // With no writer left the read end reports EPOLLHUP on every wait.
+    // Reopening gives a fresh read end that stays quiet until the next
+    // writer connects, instead of spinning on EOF.
+    void rearm(int fd) {
+        Watch watch = watches[fd];
+        remove(fd);
+        close(fd);
+        int reopened = open(watch.fifoPath.c_str(), O_RDONLY | O_NONBLOCK);
+        if (reopened != -1) {
+            add(reopened, EPOLLIN, watch);
+            rearms++;
+        }
+    }
+
+public:
+    EventLoop() : wakeups(0), rearms(0), running(false) {
+        epollFd = epoll_create1(EPOLL_CLOEXEC);
+        stopFd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+        epoll_event event = {};
+        event.events = EPOLLIN;
+        event.data.fd = stopFd;
+        epoll_ctl(epollFd, EPOLL_CTL_ADD, stopFd, &event);
+    }
+
+    ~EventLoop() {
+        for (auto& pair : watches) {
+            close(pair.first);
+        }
+        close(stopFd);
+        close(epollFd);
+    }
+
+    // Opens (creating if needed) a FIFO for reading and calls onReady with
+    // its current fd whenever data is waiting. Returns the fd or -1.
+    int watchFifo(const char* path, Handler onReady) {
+        mkfifo(path, 0666);
+        int fd = open(path, O_RDONLY | O_NONBLOCK);
+        if (fd == -1) return -1;
+        if (!add(fd, EPOLLIN, {onReady, path, false})) {
+            close(fd);
+            return -1;
+        }
+        return fd;
+    }
+
+    // Calls onReady when fd is writable, e.g. a pipe that returned EAGAIN.
+    // The caller unwatches it (remove) once its backlog is written.
+    bool watchWritable(int fd, Handler onReady) {
+        if (watches.count(fd)) return true;
+        return add(fd, EPOLLOUT, {onReady, "", false});
+    }
+
+    // Periodic timer, first expiry after one interval. Returns the timerfd.
+    int addTimer(int intervalMs, Handler onTick) {
+        int fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+        if (fd == -1) return -1;
+        itimerspec spec = {};
+        spec.it_interval.tv_sec = intervalMs / 1000;
+        spec.it_interval.tv_nsec = (intervalMs % 1000) * 1000000L;
+        spec.it_value = spec.it_interval;
+        timerfd_settime(fd, 0, &spec, nullptr);
+        if (!add(fd, EPOLLIN, {onTick, "", true})) {
+            close(fd);
+            return -1;
+        }
+        return fd;
+    }
+
+    // Stops watching fd, does not close it
+    void remove(int fd) {
+        epoll_ctl(epollFd, EPOLL_CTL_DEL, fd, nullptr);
+        watches.erase(fd);
+    }
+
+    // Safe from any thread or a signal handler
+    void stop() {
+        uint64_t one = 1;
+        ssize_t n = write(stopFd, &one, sizeof(one));
+        (void)n;
+    }
+
+    void run() {
+        const int MAX_EVENTS = 16;
+        epoll_event events[MAX_EVENTS];
+        running = true;
+        while (running) {
+            int n = epoll_wait(epollFd, events, MAX_EVENTS, -1);
+            if (n == -1) {
+                if (errno == EINTR) continue;
+                break;
+            }
+            wakeups++;
+            for (int i = 0; i < n && running; i++) {
+                int fd = events[i].data.fd;
+                if (fd == stopFd) {
+                    running = false;
+                    break;
+                }
+                auto it = watches.find(fd);
+                if (it == watches.end()) continue;  // removed by an earlier handler
+
+                if (it->second.timer) {
+                    uint64_t expirations;
+                    ssize_t r = read(fd, &expirations, sizeof(expirations));
+                    (void)r;
+                }
+                // drain first so data written just before the hangup is kept
+                Handler onReady = it->second.onReady;
+                onReady(fd);
+
+                if (events[i].events & (EPOLLHUP | EPOLLERR)) {
+                    it = watches.find(fd);
+                    if (it == watches.end()) continue;
+                    if (!it->second.fifoPath.empty()) {
+                        rearm(fd);
+                    } else {
+                        remove(fd);  // writer side gone, owner notices on write
+                    }
+                }
+            }
+        }
+    }
+};
+
+#endif
@@ -0,0 +1,314 @@
+#ifndef INSTRUMENTATION_H
+#define INSTRUMENTATION_H
+
+#include <atomic>
+#include <pthread.h>
+#include <signal.h>
+#include <stdint.h>
+#include <time.h>
+#include <cstdio>
+#include <cstring>
+
+// Low overhead timing for the hot paths. Every thread records into its
+// own slot, so recording never contends; a dump merges the slots. Build
+// with -DINSTRUMENTATION=0 to compile the probes out.
+#ifndef INSTRUMENTATION
+#define INSTRUMENTATION 1
+#endif
+
+// CLOCK_MONOTONIC is shared by every process on the machine, so
+// timestamps taken in the simulation can be compared in the portal
+inline uint64_t monotonicNs() {
+    timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint64_t)now.tv_sec * 1000000000ull + now.tv_nsec;
+}
+
+// Duration histogram: power of two ranges of nanoseconds split into 16
+// linear steps, so percentiles are within about 6%. One thread records,
+// any thread may read; counters are relaxed atomics so a read while
+// recording is merely a little stale.
+class LatencyHistogram {
+private:
+    static const int SUB = 16;
+    static const int BUCKETS = 40 * SUB;
+    std::atomic<long> counts[BUCKETS];
+    std::atomic<long> total;
+    std::atomic<uint64_t> sumNs;
+    std::atomic<uint64_t> maxNs;
+
+    static int bucketOf(uint64_t ns) {
+        if (ns < SUB) return (int)ns;
+        int exponent = 63 - __builtin_clzll(ns);  // ns >= 16, so >= 4
+        int sub = (int)((ns >> (exponent - 4)) & (SUB - 1));
+        int bucket = (exponent - 3) * SUB + sub;
+        return bucket < BUCKETS ? bucket : BUCKETS - 1;
+    }
+
+    // upper edge of a bucket in nanoseconds
+    static uint64_t bucketLimit(int bucket) {
+        if (bucket < SUB) return bucket;
+        int exponent = bucket / SUB + 3;
+        uint64_t sub = bucket % SUB;
+        return ((SUB + sub + 1) << (exponent - 4)) - 1;
+    }
+
+    static void bump(std::atomic<long>& counter, long by) {
+        counter.store(counter.load(std::memory_order_relaxed) + by, std::memory_order_relaxed);
+    }
+
+public:
+    LatencyHistogram() : total(0), sumNs(0), maxNs(0) {
+        for (int i = 0; i < BUCKETS; i++) counts[i].store(0, std::memory_order_relaxed);
+    }
+
+    void recordNs(uint64_t ns) {
+        bump(counts[bucketOf(ns)], 1);
+        bump(total, 1);
+        sumNs.store(sumNs.load(std::memory_order_relaxed) + ns, std::memory_order_relaxed);
+        if (ns > maxNs.load(std::memory_order_relaxed)) maxNs.store(ns, std::memory_order_relaxed);
+    }
+
+    void record(uint64_t startNs, uint64_t endNs) {
+        recordNs(endNs > startNs ? endNs - startNs : 0);
+    }
+
+    // Adds another thread's histogram into this one
+    void merge(const LatencyHistogram& other) {
+        for (int i = 0; i < BUCKETS; i++) {
+            bump(counts[i], other.counts[i].load(std::memory_order_relaxed));
+        }
+        bump(total, other.total.load(std::memory_order_relaxed));
+        sumNs.store(sumNs.load(std::memory_order_relaxed) + other.sumNs.load(std::memory_order_relaxed),
+                    std::memory_order_relaxed);
+        uint64_t otherMax = other.maxNs.load(std::memory_order_relaxed);
+        if (otherMax > maxNs.load(std::memory_order_relaxed)) maxNs.store(otherMax, std::memory_order_relaxed);
+    }
+
+    long count() const { return total.load(std::memory_order_relaxed); }
+    uint64_t totalNs() const { return sumNs.load(std::memory_order_relaxed); }
+    uint64_t max() const { return maxNs.load(std::memory_order_relaxed); }
+
+    // q in [0, 1], result in nanoseconds
+    uint64_t percentile(double q) const {
+        long n = count();
+        if (n == 0) return 0;
+        long rank = (long)(q * (n - 1)) + 1;
+        long seen = 0;
+        for (int i = 0; i < BUCKETS; i++) {
+            seen += counts[i].load(std::memory_order_relaxed);
+            if (seen >= rank) return bucketLimit(i) < max() ? bucketLimit(i) : max();
+        }
+        return max();
+    }
+
+    void print(const char* what) const {
+        printf("%s latency (%ld msgs): p50 %llu us, p90 %llu us, p99 %llu us, max %llu us\n",
+               what, count(), (unsigned long long)percentile(0.5) / 1000,
+               (unsigned long long)percentile(0.9) / 1000, (unsigned long long)percentile(0.99) / 1000,
+               (unsigned long long)max() / 1000);
+    }
+};
+
+// What a probe measures. Tick phases are timed by the task that runs
+// them, so each lands on whichever worker ran it.
+enum Probe {
+    PROBE_TICK = 0,     // whole tick graph, on the tick thread
+    PROBE_SIGNALS,      // TrafficManager::update
+    PROBE_SPAWN,        // spawnVehicles, one direction
+    PROBE_LANES,        // updateVehicles, one direction
+    PROBE_VIOLATIONS,   // checkViolations, one direction
+    PROBE_COLLISIONS,   // CollisionDetector::detect, all directions
+    PROBE_PUBLISH,      // challan flush and snapshot
+    PROBE_PACING,       // tick thread asleep until the next tick is due
+    PROBE_FRAME,        // main window frame
+    PROBE_STATS_FRAME,  // stats window frame
+    PROBE_LOCK_WAIT,    // blocked acquiring an InstrumentedMutex
+    PROBE_LOCK_HOLD,    // holding one
+    PROBE_IDLE,         // asleep on a condition variable
+    PROBE_COUNT
+};
+
+inline const char* probeName(int probe) {
+    static const char* names[PROBE_COUNT] = {
+        "tick", "signals", "spawn", "lanes", "violations", "collisions", "publish", "pacing",
+        "frame", "stats frame", "lock wait", "lock hold", "idle"};
+    return names[probe];
+}
+
+// One thread's probes, written only by that thread
+struct alignas(64) ThreadProbes {
+    char name[24];
+    LatencyHistogram probes[PROBE_COUNT];
+};
+
+class Instrumentation {
+public:
+    static const int MAX_THREADS = 64;
+
+private:
+    static inline std::atomic<ThreadProbes*> threads[MAX_THREADS];
+    static inline std::atomic<int> threadCount{0};  // slots claimed, at most MAX_THREADS
+    static inline volatile sig_atomic_t dumpRequested = 0;
+    static inline thread_local ThreadProbes* mine = nullptr;
+    static inline thread_local bool noSlot = false;  // came too late, stop asking
+
+    static void onSignal(int) {
+        dumpRequested = 1;
+    }
+
+public:
+    // This thread's slot, claimed on first use. Null once every slot is
+    // taken, the thread's probes are then dropped. The counter never goes
+    // past MAX_THREADS, and a thread that found no slot does not retry.
+    static ThreadProbes* current() {
+        if (!mine) {
+            if (noSlot) return nullptr;
+            int index = threadCount.load(std::memory_order_relaxed);
+            do {
+                if (index >= MAX_THREADS) {
+                    noSlot = true;
+                    return nullptr;
+                }
+            } while (!threadCount.compare_exchange_weak(index, index + 1));
+            mine = new ThreadProbes();
+            snprintf(mine->name, sizeof(mine->name), "thread %d", index);
+            threads[index].store(mine, std::memory_order_release);
+        }
+        return mine;
+    }
+
+    static void nameThread(const char* name) {
+        if (ThreadProbes* probes = current()) {
+            snprintf(probes->name, sizeof(probes->name), "%s", name);
+        }
+    }
+
+    static void record(Probe probe, uint64_t ns) {
+#if INSTRUMENTATION
+        if (ThreadProbes* probes = current()) probes->probes[probe].recordNs(ns);
+#else
+        (void)probe;
+        (void)ns;
+#endif
+    }
+
+    // kill -USR1 <pid> asks for a dump, pollDump() prints it from a safe
+    // place (between ticks)
+    static void installSignalHandler() {
+        struct sigaction action;
+        memset(&action, 0, sizeof(action));
+        action.sa_handler = onSignal;
+        sigemptyset(&action.sa_mask);
+        action.sa_flags = SA_RESTART;
+        sigaction(SIGUSR1, &action, nullptr);
+    }
+
+    static void pollDump() {
+        if (!dumpRequested) return;
+        dumpRequested = 0;
+        dump(stdout);
+    }
+
+    // Per thread totals and percentiles for every probe that fired, then
+    // the same merged over all threads
+    static void dump(FILE* out) {
+        int count = threadCount.load();
+        if (count > MAX_THREADS) count = MAX_THREADS;
+        LatencyHistogram* merged = new LatencyHistogram[PROBE_COUNT];
+        fprintf(out, "Instrumentation, times in us\n");
+        fprintf(out, "%-14s %-12s %10s %12s %9s %9s %9s %9s\n", "thread", "probe", "count",
+                "total", "mean", "p50", "p99", "max");
+        for (int t = 0; t < count; t++) {
+            ThreadProbes* probes = threads[t].load(std::memory_order_acquire);
+            if (!probes) continue;
+            for (int p = 0; p < PROBE_COUNT; p++) {
+                const LatencyHistogram& h = probes->probes[p];
+                if (h.count() == 0) continue;
+                printRow(out, probes->name, p, h);
+                merged[p].merge(h);
+            }
+        }
+        for (int p = 0; p < PROBE_COUNT; p++) {
+            if (merged[p].count() > 0) printRow(out, "all", p, merged[p]);
+        }
+        fflush(out);
+        delete[] merged;
+    }
+
+private:
+    static void printRow(FILE* out, const char* thread, int probe, const LatencyHistogram& h) {
+        fprintf(out, "%-14s %-12s %10ld %12.0f %9.2f %9.2f %9.2f %9.2f\n", thread, probeName(probe),
+                h.count(), h.totalNs() / 1e3, h.totalNs() / 1e3 / h.count(), h.percentile(0.5) / 1e3,
+                h.percentile(0.99) / 1e3, h.max() / 1e3);
+    }
+};
+
+// Times its own scope into the calling thread's probe
+class ScopedTimer {
+#if INSTRUMENTATION
+private:
+    Probe probe;
+    uint64_t start;
+
+public:
+    explicit ScopedTimer(Probe probe) : probe(probe), start(monotonicNs()) {}
+    ~ScopedTimer() { Instrumentation::record(probe, monotonicNs() - start); }
+#else
+public:
+    explicit ScopedTimer(Probe) {}
+#endif
+};
+
+// pthread mutex that records how long each lock() waited and how long
+// the lock was then held, on the calling thread
+class InstrumentedMutex {
+private:
+    pthread_mutex_t mutex;
+    uint64_t lockedAt;  // only touched while held
+
+public:
+    InstrumentedMutex() : lockedAt(0) {
+        pthread_mutex_init(&mutex, NULL);
+    }
+
+    ~InstrumentedMutex() {
+        pthread_mutex_destroy(&mutex);
+    }
+
+    void lock() {
+#if INSTRUMENTATION
+        uint64_t start = monotonicNs();
+        if (pthread_mutex_trylock(&mutex) != 0) {
+            pthread_mutex_lock(&mutex);
+        }
+        lockedAt = monotonicNs();
+        Instrumentation::record(PROBE_LOCK_WAIT, lockedAt - start);
+#else
+        pthread_mutex_lock(&mutex);
+#endif
+    }
+
+    void unlock() {
+#if INSTRUMENTATION
+        Instrumentation::record(PROBE_LOCK_HOLD, monotonicNs() - lockedAt);
+#endif
+        pthread_mutex_unlock(&mutex);
+    }
+
+    // pthread_cond_wait on this mutex; the lock is not held while asleep,
+    // so that time counts as idle rather than hold
+    void wait(pthread_cond_t* cond) {
+#if INSTRUMENTATION
+        uint64_t start = monotonicNs();
+        Instrumentation::record(PROBE_LOCK_HOLD, start - lockedAt);
+        pthread_cond_wait(cond, &mutex);
+        lockedAt = monotonicNs();
+        Instrumentation::record(PROBE_IDLE, lockedAt - start);
+#else
+        pthread_cond_wait(cond, &mutex);
+#endif
+    }
+};
+
+#endif
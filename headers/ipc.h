@@ -0,0 +1,164 @@
+#ifndef IPC_H
+#define IPC_H
+
+#include "challanprotocol.h"
+#include "challanstore.h"
+#include "instrumentation.h"
+#include <errno.h>
+#include <unistd.h>
+#include <time.h>
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <vector>
+
+// Framing for every FIFO between the simulation, challan, userportal and
+// stripepayment. Each message is a FrameHeader followed by length bytes of
+// payload, all in host byte order (every process runs on one machine).
+// Readers push whatever read() returned into a FrameDecoder and pull out
+// complete frames, so coalesced or split reads are handled.
+
+const uint16_t IPC_VERSION = 3;  // 2: detection timestamps, 3: packed batch records
+const uint32_t IPC_MAX_PAYLOAD = 64 * 1024;
+
+enum IpcType : uint16_t {
+    IPC_CHALLAN_BATCH = 1,  // simulation -> challan, count + records, see appendBatchFrame
+    IPC_CHALLAN_ISSUED,     // challan -> userportal, ChallanIssued
+    IPC_PAYMENT             // stripepayment -> challan and userportal, PaymentMessage
+};
+
+struct FrameHeader {
+    uint16_t version;
+    uint16_t type;
+    uint32_t length;  // payload bytes after the header
+};
+
+struct ChallanIssued {
+    ChallanEntry entry;
+    uint64_t detectedNs;  // ChallanRecord::detectedNs, for latency
+};
+
+struct PaymentMessage {
+    uint64_t challanId;
+    char plate[32];
+    uint8_t status;  // ChallanStatus
+};
+
+// Appends one frame to out
+inline void appendFrame(std::string& out, IpcType type, const void* payload, uint32_t length) {
+    FrameHeader header = {IPC_VERSION, type, length};
+    out.append((const char*)&header, sizeof(header));
+    out.append((const char*)payload, length);
+}
+
+// Batch payload: the uint32_t count, then the used records back to back.
+// Written field by field because ChallanBatch has padding between count
+// and records (ChallanRecord holds a uint64_t), which must not go on the
+// wire. Read it back with batchRecordCount and batchRecord.
+inline void appendBatchFrame(std::string& out, const ChallanBatch& batch) {
+    uint32_t length = sizeof(batch.count) + batch.count * sizeof(ChallanRecord);
+    FrameHeader header = {IPC_VERSION, IPC_CHALLAN_BATCH, length};
+    out.append((const char*)&header, sizeof(header));
+    out.append((const char*)&batch.count, sizeof(batch.count));
+    out.append((const char*)batch.records, batch.count * sizeof(ChallanRecord));
+}
+
+// Records in a batch payload, no more than its length holds
+inline uint32_t batchRecordCount(const FrameHeader& header, const char* payload) {
+    if (header.type != IPC_CHALLAN_BATCH || header.length < sizeof(uint32_t)) return 0;
+    uint32_t count;
+    memcpy(&count, payload, sizeof(count));
+    uint32_t fits = (header.length - sizeof(count)) / sizeof(ChallanRecord);
+    return count < fits ? count : fits;
+}
+
+inline void batchRecord(const char* payload, uint32_t i, ChallanRecord& record) {
+    memcpy(&record, payload + sizeof(uint32_t) + i * sizeof(ChallanRecord), sizeof(record));
+}
+
+// Writes as much of out as the pipe takes and drops the written part.
+// Returns false if the reader is gone (EPIPE); EAGAIN just leaves the rest.
+inline bool writePending(int fd, std::string& out) {
+    size_t done = 0;
+    while (done < out.size()) {
+        ssize_t n = write(fd, out.data() + done, out.size() - done);
+        if (n > 0) {
+            done += n;
+        } else if (n == -1 && errno == EINTR) {
+            continue;
+        } else {
+            out.erase(0, done);
+            return n == -1 && errno == EAGAIN;
+        }
+    }
+    out.clear();
+    return true;
+}
+
+// Streaming decoder: feed() raw bytes, then next() until it returns false
+class FrameDecoder {
+private:
+    std::vector<char> buffer;
+    size_t start;  // first unconsumed byte
+
+public:
+    long frames;  // decoded so far
+    long errors;  // bad version or length, buffer dropped to resync
+
+    FrameDecoder() : start(0), frames(0), errors(0) {
+        buffer.reserve(64 * 1024);
+    }
+
+    void feed(const char* data, size_t size) {
+        // slide unread bytes down instead of growing forever
+        if (start > 0 && start == buffer.size()) {
+            buffer.clear();
+            start = 0;
+        } else if (start > buffer.capacity() / 2) {
+            buffer.erase(buffer.begin(), buffer.begin() + start);
+            start = 0;
+        }
+        buffer.insert(buffer.end(), data, data + size);
+    }
+
+    // Reads everything waiting on a non-blocking fd into the decoder.
+    // Returns bytes read, 0 on EOF (no writer) and -1 when nothing waited.
+    ssize_t readFrom(int fd) {
+        char chunk[16 * 1024];
+        ssize_t total = 0;
+        while (true) {
+            ssize_t n = read(fd, chunk, sizeof(chunk));
+            if (n > 0) {
+                feed(chunk, n);
+                total += n;
+                if (n < (ssize_t)sizeof(chunk)) return total;
+            } else if (n == 0) {
+                return total;
+            } else if (errno == EINTR) {
+                continue;
+            } else {
+                return total > 0 ? total : -1;
+            }
+        }
+    }
+
+    // Next complete frame; payload points into the decoder and stays valid
+    // until the next feed()
+    bool next(FrameHeader& header, const char*& payload) {
+        if (buffer.size() - start < sizeof(FrameHeader)) return false;
+        memcpy(&header, buffer.data() + start, sizeof(header));
+        if (header.version != IPC_VERSION || header.length > IPC_MAX_PAYLOAD) {
+            errors++;
+            buffer.clear();
+            start = 0;
+            return false;
+        }
+        if (buffer.size() - start < sizeof(FrameHeader) + header.length) return false;
+        payload = buffer.data() + start + sizeof(FrameHeader);
+        start += sizeof(FrameHeader) + header.length;
+        frames++;
+        return true;
+    }
+};
+
+#endif
@@ -0,0 +1,389 @@
+#ifndef METRICS_H
+#define METRICS_H
+
+#include <atomic>
+#include <pthread.h>
+#include <poll.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <stdint.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <algorithm>
+#include <sched.h>
+#include "instrumentation.h"
+
+// Metrics shared by the simulator, challan, userportal and stripepayment.
+// Every process maps the same shared memory segment and registers its
+// metrics into fixed slots; updating one is a relaxed atomic on the slot,
+// no lock and no syscall. The simulator's MetricsExporter reads all slots
+// and serves them in the Prometheus text format on localhost and as a
+// snapshot file, so scraping never touches the processes being measured.
+
+enum MetricType : int32_t {
+    METRIC_COUNTER = 1,
+    METRIC_GAUGE,
+    METRIC_HISTOGRAM
+};
+
+// Histogram bucket upper bounds, sized for tick and ingest times
+static const int METRIC_BUCKETS = 12;
+static const uint64_t METRIC_BOUNDS_NS[METRIC_BUCKETS] = {
+    10000, 25000, 50000, 100000, 250000, 500000,
+    1000000, 2500000, 5000000, 10000000, 25000000, 100000000};
+
+struct MetricSlot {
+    std::atomic<int32_t> state;  // 0 free, 1 being filled in, 2 ready
+    int32_t type;
+    char name[48];
+    char labels[48];  // e.g. direction="north",lane="1"
+    char help[96];
+    std::atomic<int64_t> value;  // counter or gauge, histogram count
+    std::atomic<uint64_t> sumNs;
+    std::atomic<uint64_t> buckets[METRIC_BUCKETS + 1];  // last one is +Inf
+};
+
+static_assert(std::atomic<int64_t>::is_always_lock_free &&
+              std::atomic<uint64_t>::is_always_lock_free,
+              "metric slots are shared between processes");
+
+struct MetricsSegment {
+    static const int MAX_METRICS = 128;
+    std::atomic<int32_t> used;  // one past the highest slot ever claimed
+    MetricSlot slots[MAX_METRICS];
+};
+
+class Counter {
+private:
+    MetricSlot* slot;
+
+public:
+    explicit Counter(MetricSlot* slot = nullptr) : slot(slot) {}
+    void add(int64_t n = 1) {
+        if (slot) slot->value.fetch_add(n, std::memory_order_relaxed);
+    }
+};
+
+class Gauge {
+private:
+    MetricSlot* slot;
+
+public:
+    explicit Gauge(MetricSlot* slot = nullptr) : slot(slot) {}
+    void set(int64_t v) {
+        if (slot) slot->value.store(v, std::memory_order_relaxed);
+    }
+    void add(int64_t n) {
+        if (slot) slot->value.fetch_add(n, std::memory_order_relaxed);
+    }
+};
+
+class Histogram {
+private:
+    MetricSlot* slot;
+
+public:
+    explicit Histogram(MetricSlot* slot = nullptr) : slot(slot) {}
+    void recordNs(uint64_t ns) {
+        if (!slot) return;
+        int b = 0;
+        while (b < METRIC_BUCKETS && ns > METRIC_BOUNDS_NS[b]) b++;
+        slot->buckets[b].fetch_add(1, std::memory_order_relaxed);
+        slot->sumNs.fetch_add(ns, std::memory_order_relaxed);
+        slot->value.fetch_add(1, std::memory_order_relaxed);
+    }
+};
+
+// The process's view of the segment. Registering the same name and labels
+// again (a restarted portal, a second payment window) hands back the
+// existing slot, so values keep accumulating. Handles from a full or
+// unavailable registry are no-ops.
+class MetricsRegistry {
+private:
+    MetricsSegment* segment;
+
+    static constexpr const char* SHM_NAME = "/smarttraffix_metrics";
+
+    MetricsRegistry() : segment(nullptr) {
+        int fd = shm_open(SHM_NAME, O_RDWR | O_CREAT, 0666);
+        if (fd != -1) {
+            // new pages read as zero, an empty registry
+            if (ftruncate(fd, sizeof(MetricsSegment)) == 0) {
+                void* p = mmap(NULL, sizeof(MetricsSegment), PROT_READ | PROT_WRITE,
+                               MAP_SHARED, fd, 0);
+                if (p != MAP_FAILED) segment = (MetricsSegment*)p;
+            }
+            close(fd);
+        }
+        if (!segment) {
+            // no shared memory, keep the metrics private to this process
+            void* p = mmap(NULL, sizeof(MetricsSegment), PROT_READ | PROT_WRITE,
+                           MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+            if (p != MAP_FAILED) segment = (MetricsSegment*)p;
+        }
+    }
+
+    // A slot another process is filling in, up to a second so a process
+    // that died half way through cannot block registration for good
+    static int32_t settled(const MetricSlot& slot) {
+        uint64_t deadline = monotonicNs() + 1000000000ull;
+        int32_t state = slot.state.load(std::memory_order_acquire);
+        while (state == 1 && monotonicNs() < deadline) {
+            sched_yield();
+            state = slot.state.load(std::memory_order_acquire);
+        }
+        return state;
+    }
+
+    // Slots are taken in index order, each with a CAS from free to being
+    // filled in. A registration walks every slot before the one it takes
+    // and waits out any still being filled in, so when two processes race
+    // for the same series the loser sees the winner's slot and returns it
+    // instead of creating a duplicate.
+    MetricSlot* claim(MetricType type, const char* name, const char* help, const char* labels) {
+        if (!segment) return nullptr;
+        int index = 0;
+        while (index < MetricsSegment::MAX_METRICS) {
+            MetricSlot& slot = segment->slots[index];
+            int32_t state = settled(slot);
+            if (state == 2 && strcmp(slot.name, name) == 0 && strcmp(slot.labels, labels) == 0) {
+                return &slot;
+            }
+            if (state != 0) {
+                index++;
+                continue;
+            }
+            int32_t expected = 0;
+            if (slot.state.compare_exchange_strong(expected, 1, std::memory_order_acq_rel)) break;
+            // lost the slot, look at what the winner put there
+        }
+        if (index == MetricsSegment::MAX_METRICS) return nullptr;
+        MetricSlot& slot = segment->slots[index];
+        int32_t used = segment->used.load(std::memory_order_relaxed);
+        while (used <= index &&
+               !segment->used.compare_exchange_weak(used, index + 1, std::memory_order_acq_rel)) {
+        }
+        slot.type = type;
+        snprintf(slot.name, sizeof(slot.name), "%s", name);
+        snprintf(slot.labels, sizeof(slot.labels), "%s", labels);
+        snprintf(slot.help, sizeof(slot.help), "%s", help);
+        slot.state.store(2, std::memory_order_release);
+        return &slot;
+    }
+
+public:
+    static MetricsRegistry& instance() {
+        static MetricsRegistry registry;
+        return registry;
+    }
+
+    // Simulator only, before anything registers or forks: starts the run
+    // with a fresh segment instead of the previous run's values
+    static void reset() {
+        shm_unlink(SHM_NAME);
+    }
+
+    Counter counter(const char* name, const char* help, const char* labels = "") {
+        return Counter(claim(METRIC_COUNTER, name, help, labels));
+    }
+
+    Gauge gauge(const char* name, const char* help, const char* labels = "") {
+        return Gauge(claim(METRIC_GAUGE, name, help, labels));
+    }
+
+    Histogram histogram(const char* name, const char* help, const char* labels = "") {
+        return Histogram(claim(METRIC_HISTOGRAM, name, help, labels));
+    }
+
+    // Prometheus text exposition of every ready slot. Series of one name
+    // are kept together even when several processes registered them.
+    void format(std::string& out) const {
+        out.clear();
+        if (!segment) return;
+        int used = std::min<int>(segment->used.load(std::memory_order_acquire), MetricsSegment::MAX_METRICS);
+        static const char* types[] = {"", "counter", "gauge", "histogram"};
+        char line[256];
+        for (int i = 0; i < used; i++) {
+            const MetricSlot& first = segment->slots[i];
+            if (!ready(first)) continue;
+            bool seen = false;
+            for (int j = 0; j < i && !seen; j++) {
+                seen = ready(segment->slots[j]) && strcmp(segment->slots[j].name, first.name) == 0;
+            }
+            if (seen) continue;  // printed with its first series
+
+            snprintf(line, sizeof(line), "# HELP %s %s\n# TYPE %s %s\n", first.name, first.help,
+                     first.name, types[first.type]);
+            out += line;
+            for (int j = i; j < used; j++) {
+                const MetricSlot& slot = segment->slots[j];
+                if (ready(slot) && strcmp(slot.name, first.name) == 0) appendSeries(out, slot);
+            }
+        }
+    }
+
+private:
+    static bool ready(const MetricSlot& slot) {
+        return slot.state.load(std::memory_order_acquire) == 2;
+    }
+
+    static void appendSeries(std::string& out, const MetricSlot& slot) {
+        char line[256];
+        const char* open = slot.labels[0] ? "{" : "";
+        const char* close = slot.labels[0] ? "}" : "";
+        if (slot.type != METRIC_HISTOGRAM) {
+            snprintf(line, sizeof(line), "%s%s%s%s %lld\n", slot.name, open, slot.labels, close,
+                     (long long)slot.value.load(std::memory_order_relaxed));
+            out += line;
+            return;
+        }
+        const char* comma = slot.labels[0] ? "," : "";
+        uint64_t cumulative = 0;
+        for (int b = 0; b <= METRIC_BUCKETS; b++) {
+            cumulative += slot.buckets[b].load(std::memory_order_relaxed);
+            char bound[24];
+            if (b < METRIC_BUCKETS) {
+                snprintf(bound, sizeof(bound), "%g", METRIC_BOUNDS_NS[b] / 1e9);
+            } else {
+                snprintf(bound, sizeof(bound), "+Inf");
+            }
+            snprintf(line, sizeof(line), "%s_bucket{%s%sle=\"%s\"} %llu\n", slot.name, slot.labels,
+                     comma, bound, (unsigned long long)cumulative);
+            out += line;
+        }
+        snprintf(line, sizeof(line), "%s_sum%s%s%s %.9f\n%s_count%s%s%s %llu\n", slot.name, open,
+                 slot.labels, close, slot.sumNs.load(std::memory_order_relaxed) / 1e9, slot.name, open,
+                 slot.labels, close, (unsigned long long)cumulative);
+        out += line;
+    }
+};
+
+// Serves the registry on http://127.0.0.1:<port>/metrics and rewrites a
+// snapshot file every interval, from its own thread. The simulation's
+// threads never wait for it.
+class MetricsExporter {
+private:
+    int port;            // 0 for no HTTP endpoint
+    std::string path;    // empty for no snapshot file
+    int intervalMs;
+    int listenFd;
+    pthread_t thread;
+    std::atomic<bool> running;
+    bool started;
+    std::string text;    // exporter thread's format buffer, reused
+
+    bool listenLocal() {
+        listenFd = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+        if (listenFd == -1) return false;
+        int one = 1;
+        setsockopt(listenFd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+        sockaddr_in address;
+        memset(&address, 0, sizeof(address));
+        address.sin_family = AF_INET;
+        address.sin_port = htons(port);
+        address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+        if (bind(listenFd, (sockaddr*)&address, sizeof(address)) == -1 || listen(listenFd, 8) == -1) {
+            close(listenFd);
+            listenFd = -1;
+            return false;
+        }
+        return true;
+    }
+
+    // One request per connection, any path gets the metrics
+    void serve() {
+        int client = accept4(listenFd, NULL, NULL, SOCK_CLOEXEC);
+        if (client == -1) return;
+        timeval timeout = {1, 0};
+        setsockopt(client, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+        setsockopt(client, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+        char request[1024];
+        ssize_t n = recv(client, request, sizeof(request), 0);
+        (void)n;  // the request itself does not matter
+
+        MetricsRegistry::instance().format(text);
+        char header[128];
+        int length = snprintf(header, sizeof(header),
+                              "HTTP/1.0 200 OK\r\nContent-Type: text/plain; version=0.0.4\r\n"
+                              "Content-Length: %zu\r\n\r\n", text.size());
+        send(client, header, length, MSG_NOSIGNAL);
+        send(client, text.data(), text.size(), MSG_NOSIGNAL);
+        close(client);
+    }
+
+    // Written beside the target and renamed over it, so readers never see
+    // half a snapshot
+    void writeSnapshot() {
+        MetricsRegistry::instance().format(text);
+        std::string temp = path + ".tmp";
+        FILE* file = fopen(temp.c_str(), "w");
+        if (!file) return;
+        bool ok = fwrite(text.data(), 1, text.size(), file) == text.size();
+        ok = fclose(file) == 0 && ok;
+        if (ok) rename(temp.c_str(), path.c_str());
+    }
+
+    static void* exporterLoop(void* arg) {
+        MetricsExporter* exporter = (MetricsExporter*)arg;
+        struct pollfd listening = {exporter->listenFd, POLLIN, 0};
+        const uint64_t interval = (uint64_t)exporter->intervalMs * 1000000ull;
+        uint64_t nextSnapshot = monotonicNs() + interval;
+        while (exporter->running) {
+            // short waits so stop() is noticed quickly; a served request
+            // wakes the loop early, so the snapshot keeps its own deadline
+            const int WAIT_MS = 100;
+            if (exporter->listenFd != -1 && poll(&listening, 1, WAIT_MS) > 0) {
+                exporter->serve();
+            } else if (exporter->listenFd == -1) {
+                usleep(WAIT_MS * 1000);
+            }
+            uint64_t now = monotonicNs();
+            if (now >= nextSnapshot && !exporter->path.empty()) {
+                exporter->writeSnapshot();
+                nextSnapshot += interval;
+                if (nextSnapshot <= now) nextSnapshot = now + interval;  // fell behind, skip
+            }
+        }
+        if (!exporter->path.empty()) exporter->writeSnapshot();  // final values
+        return NULL;
+    }
+
+public:
+    MetricsExporter() : port(0), intervalMs(0), listenFd(-1), running(false), started(false) {}
+
+    MetricsExporter(const MetricsExporter&) = delete;
+    MetricsExporter& operator=(const MetricsExporter&) = delete;
+
+    // False if the port could not be bound; the snapshot file is still written
+    bool start(int httpPort, const std::string& snapshotPath, int snapshotIntervalMs) {
+        if (started) return true;
+        port = httpPort;
+        path = snapshotPath;
+        intervalMs = snapshotIntervalMs;
+        bool listening = port == 0 || listenLocal();
+        running = true;
+        started = true;
+        pthread_create(&thread, NULL, exporterLoop, this);
+        return listening;
+    }
+
+    void stop() {
+        if (!started) return;
+        running = false;
+        pthread_join(thread, NULL);
+        if (listenFd != -1) close(listenFd);
+        listenFd = -1;
+        started = false;
+    }
+
+    ~MetricsExporter() {
+        stop();
+    }
+};
+
+#endif
@@ -0,0 +1,82 @@
+#ifndef RNG_H
+#define RNG_H
+
+#include <stdint.h>
+
+// Counter based random numbers (Philox4x32-10, Salmon et al., SC'11).
+// A draw is a pure function of the run seed and a counter naming what it
+// is for, so there is no shared state to lock and the same run gives the
+// same bits whatever thread, or how many threads, make the draws.
+//
+// counter = { index within the tick, tick, stream id, stream kind }
+// key     = run seed
+
+enum RngKind {
+    RNG_VEHICLE = 1,  // stream is the vehicle id
+    RNG_SPAWNER = 2,  // stream is the direction
+    RNG_NETWORK = 3   // stream is the network vehicle id
+};
+
+// Set once before the simulation starts, like srand used to be
+inline uint64_t rngSeed = 1;
+
+// Ten rounds of Philox on one 128 bit counter block
+inline void philox4x32(const uint32_t counter[4], uint64_t seed, uint32_t out[4]) {
+    uint32_t c0 = counter[0], c1 = counter[1], c2 = counter[2], c3 = counter[3];
+    uint32_t k0 = (uint32_t)seed, k1 = (uint32_t)(seed >> 32);
+    for (int round = 0; round < 10; round++) {
+        uint64_t p0 = (uint64_t)0xD2511F53u * c0;
+        uint64_t p1 = (uint64_t)0xCD9E8D57u * c2;
+        uint32_t n0 = (uint32_t)(p1 >> 32) ^ c1 ^ k0;
+        uint32_t n2 = (uint32_t)(p0 >> 32) ^ c3 ^ k1;
+        c1 = (uint32_t)p1;
+        c3 = (uint32_t)p0;
+        c0 = n0;
+        c2 = n2;
+        k0 += 0x9E3779B9u;
+        k1 += 0xBB67AE85u;
+    }
+    out[0] = c0;
+    out[1] = c1;
+    out[2] = c2;
+    out[3] = c3;
+}
+
+// Draws for one (kind, stream, tick), four words per Philox block. Lives
+// on the stack of whoever draws, so tasks on different workers never
+// touch the same generator.
+class RandomStream {
+private:
+    uint32_t counter[4];
+    uint32_t block[4];
+    int used;
+
+public:
+    RandomStream(RngKind kind, uint32_t stream, uint32_t tick) : used(4) {
+        counter[0] = 0;
+        counter[1] = tick;
+        counter[2] = stream;
+        counter[3] = kind;
+    }
+
+    uint32_t next() {
+        if (used == 4) {
+            philox4x32(counter, rngSeed, block);
+            counter[0]++;
+            used = 0;
+        }
+        return block[used++];
+    }
+
+    // In [0, n)
+    int below(int n) {
+        return (int)(((uint64_t)next() * (uint32_t)n) >> 32);
+    }
+
+    // In [0, 1)
+    float uniform() {
+        return (next() >> 8) * (1.0f / 16777216.0f);
+    }
+};
+
+#endif
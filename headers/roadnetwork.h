@@ -0,0 +1,654 @@
+#ifndef ROADNETWORK_H
+#define ROADNETWORK_H
+
+#include "util.h"
+#include "idm.h"
+#include "taskscheduler.h"
+#include "rng.h"
+#include "simclock.h"
+#include <chrono>
+#include <vector>
+#include <string>
+#include <fstream>
+#include <sstream>
+#include <unordered_map>
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <stdint.h>
+
+// City scale model for headless runs: signalised intersections (nodes)
+// joined by directed links, each link a few lanes of vehicles in road
+// order. The windowed demo keeps its single drawn crossroads from util.h.
+//
+// Network file, one item per line, '#' starts a comment:
+//   node <id> <x> <y>
+//   link <from node> <to node> <length> <lanes> <speed limit>
+//   source <node> <vehicles per minute>
+// Lengths are in the same pixels and speeds in the same units the
+// single intersection uses, so IdmParams carry over unchanged.
+
+struct NetVehicle {
+    int id;
+    int nextLink;   // picked on entry, -1 leaves the network at the link end
+    int tripLeft;   // links still to drive after this one
+    float pos;      // centre, distance from the start of the link
+    float speed;
+    float desired;
+    float length;
+};
+
+// One lane of a link, ring of vehicles with the front (nearest the stop
+// line) first. Rings live in RoadNetwork::vehiclePool, sized at load.
+struct NetLane {
+    NetVehicle* ring;
+    int capacity;
+    int head;
+    int count;
+    float entryRoom;  // free road behind the tail, published after delivery
+    float claimed;    // room promised to arrivals this tick
+
+    NetVehicle& at(int k) { return ring[(head + k) % capacity]; }
+    NetVehicle& front() { return ring[head]; }
+    NetVehicle& back() { return at(count - 1); }
+
+    void pushBack(const NetVehicle& vehicle) {
+        ring[(head + count) % capacity] = vehicle;
+        count++;
+    }
+
+    void popFront() {
+        head = (head + 1) % capacity;
+        count--;
+    }
+};
+
+struct NetLink {
+    int from, to;      // node indices
+    float length;
+    float speedLimit;
+    int laneCount;
+    int firstLane;     // index into RoadNetwork::lanes
+    int approach;      // position in the to node's incoming list
+    int reverse;       // link going back the other way, or -1
+};
+
+struct NetNode {
+    int id;            // as written in the file
+    float x, y;
+    int partition;
+    std::vector<int> in, out;  // link indices
+
+    // round robin signal over the incoming links, like TrafficManager
+    int green;
+    float timer;
+    bool yellow;
+
+    float spawnInterval;  // seconds between spawns, 0 for none
+    float spawnTimer;
+    int spawnCursor;      // next outgoing link to spawn on
+};
+
+// A vehicle crossing a node into a link. Written by the partition that
+// owns the node, read by the partition that owns the link.
+struct Transfer {
+    int link;
+    int lane;
+    NetVehicle vehicle;  // pos holds how far past the stop line it got
+};
+
+// Nodes stepped by one task. A link belongs to the partition of the node
+// it ends at, since that node's signal controls it; vehicles leaving the
+// partition go out through the outbox and are delivered by the owner
+// once every partition feeding it has stepped.
+struct NetPartition {
+    class RoadNetwork* net;
+    int index;
+    std::vector<int> nodes;
+    std::vector<int> links;    // owned: every incoming link of nodes
+    std::vector<int> feeders;  // partitions that send into owned links, self included
+    std::vector<Transfer> outbox;
+    int outCount;
+    std::vector<float> idmScratch;  // stepLane's packed lane, sized once in partition()
+
+    long spawned;
+    long completed;  // trips that ended at one of our nodes
+    long handedOff;  // transfers to another partition
+    long lost;       // deliveries with no ring slot, should stay 0
+};
+
+class RoadNetwork {
+public:
+    static constexpr float LIGHT_INTERVAL = 10.0f;
+    static constexpr float YELLOW_DURATION = 2.0f;
+    static const int MAX_LANE_VEHICLES = 256;
+
+    std::vector<NetNode> nodes;
+    std::vector<NetLink> links;
+    std::vector<NetLane> lanes;
+    std::vector<NetPartition> partitions;
+    std::vector<NetVehicle> vehiclePool;
+    IdmParams idm;
+    float tickDelta;
+
+private:
+    bool isGreen(int link) const {
+        const NetLink& l = links[link];
+        const NetNode& node = nodes[l.to];
+        return node.in.size() == 1 || (!node.yellow && node.green == l.approach);
+    }
+
+    // Space a new arrival could take on the best lane of link
+    int bestLane(int link, float& room) const {
+        const NetLink& l = links[link];
+        int best = l.firstLane;
+        room = -1.0f;
+        for (int i = l.firstLane; i < l.firstLane + l.laneCount; i++) {
+            float free = lanes[i].entryRoom - lanes[i].claimed;
+            if (free > room) {
+                room = free;
+                best = i;
+            }
+        }
+        return best;
+    }
+
+    // Queues vehicle for link if the room published last tick still has
+    // space for it after this tick's other claims
+    bool send(NetPartition& p, int link, const NetVehicle& vehicle) {
+        float room;
+        int lane = bestLane(link, room);
+        float need = vehicle.length + idm.minGap;
+        if (room < need || p.outCount == (int)p.outbox.size()) return false;
+        lanes[lane].claimed += need;
+        Transfer& t = p.outbox[p.outCount++];
+        t.link = link;
+        t.lane = lane;
+        t.vehicle = vehicle;
+        if (nodes[links[link].to].partition != p.index) p.handedOff++;
+        return true;
+    }
+
+    int chooseNext(int link, const NetVehicle& vehicle) const {
+        const NetLink& l = links[link];
+        const NetNode& node = nodes[l.to];
+        int options = 0;
+        for (int out : node.out) {
+            if (out != l.reverse) options++;
+        }
+        if (options == 0) return -1;
+        // keyed by the link instead of the tick, the choice is made once per link
+        int pick = RandomStream(RNG_NETWORK, vehicle.id, link + 1).below(options);
+        for (int out : node.out) {
+            if (out != l.reverse && pick-- == 0) return out;
+        }
+        return -1;
+    }
+
+    void updateSignal(NetNode& node, float dt) {
+        if (node.in.size() < 2) return;
+        node.timer += dt;
+        if (node.yellow && node.timer >= YELLOW_DURATION) {
+            node.green = (node.green + 1) % node.in.size();
+            node.yellow = false;
+            node.timer = 0;
+        } else if (!node.yellow && node.timer >= LIGHT_INTERVAL) {
+            node.yellow = true;
+            node.timer = 0;
+        }
+    }
+
+    void spawnAt(NetPartition& p, NetNode& node, float dt) {
+        if (node.spawnInterval <= 0 || node.out.empty()) return;
+        node.spawnTimer += dt;
+        while (node.spawnTimer >= node.spawnInterval) {
+            int link = node.out[node.spawnCursor % node.out.size()];
+            NetVehicle vehicle;
+            // counted per node, so ids do not depend on the partitioning
+            vehicle.id = node.spawnCursor * (int)nodes.size() + (int)(&node - &nodes[0]);
+            RandomStream rng(RNG_NETWORK, vehicle.id, 0);
+            vehicle.length = 20.0f + rng.below(3) * 5.0f;
+            vehicle.desired = links[link].speedLimit * (0.85f + rng.below(31) / 100.0f);
+            vehicle.speed = vehicle.desired * 0.5f;
+            vehicle.tripLeft = 2 + rng.below(12);
+            vehicle.nextLink = -1;
+            vehicle.pos = 0;
+            if (!send(p, link, vehicle)) {
+                node.spawnTimer = node.spawnInterval;  // entry blocked, retry next tick
+                return;
+            }
+            node.spawnTimer -= node.spawnInterval;
+            node.spawnCursor++;
+            p.spawned++;
+        }
+    }
+
+    // IDM for one lane front to back, same packing as updateLaneIdm. The
+    // front vehicle stops at the line on red or when its next link has
+    // no room; otherwise it crosses and is handed to the next link.
+    void stepLane(NetPartition& p, int link, NetLane& lane, float dt) {
+        const int n = std::min(lane.count, MAX_LANE_VEHICLES);
+        if (n == 0) return;
+        const NetLink& l = links[link];
+        float* gap = &p.idmScratch[0];
+        float* speed = gap + MAX_LANE_VEHICLES;
+        float* dv = speed + MAX_LANE_VEHICLES;
+        float* desired = dv + MAX_LANE_VEHICLES;
+        float* accel = desired + MAX_LANE_VEHICLES;
+
+        NetVehicle& first = lane.front();
+        bool canLeave = isGreen(link);
+        if (canLeave && first.nextLink >= 0) {
+            float room;
+            bestLane(first.nextLink, room);
+            canLeave = room >= first.length + idm.minGap;
+        }
+
+        for (int k = 0; k < n; k++) {
+            NetVehicle& v = lane.at(k);
+            speed[k] = v.speed;
+            desired[k] = v.desired;
+            gap[k] = IDM_FREE_GAP;
+            dv[k] = 0;
+            if (k > 0) {
+                NetVehicle& ahead = lane.at(k - 1);
+                gap[k] = ahead.pos - ahead.length / 2 - (v.pos + v.length / 2);
+                dv[k] = v.speed - ahead.speed;
+            } else if (!canLeave) {
+                gap[k] = l.length - (v.pos + v.length / 2);
+                dv[k] = v.speed;
+            }
+            gap[k] = std::max(gap[k], 0.1f);
+        }
+
+        idmAccelerations(gap, speed, dv, desired, accel, n, idm);
+
+        for (int k = 0; k < n; k++) {
+            NetVehicle& v = lane.at(k);
+            v.speed = std::max(0.0f, speed[k] + accel[k] * dt);
+            float next = v.pos + v.speed * dt;
+            if (k > 0) {
+                NetVehicle& ahead = lane.at(k - 1);
+                next = std::min(next, ahead.pos - (ahead.length + v.length) / 2);
+            } else if (!canLeave) {
+                next = std::min(next, l.length - v.length / 2);
+            }
+            v.pos = next;
+        }
+
+        // fronts whose bumper crossed the stop line go through the node
+        while (lane.count > 0) {
+            NetVehicle& v = lane.front();
+            float past = v.pos + v.length / 2 - l.length;
+            if (past < 0 || !canLeave) break;
+            if (v.nextLink < 0) {
+                p.completed++;
+            } else {
+                NetVehicle moved = v;
+                moved.pos = past;
+                if (!send(p, v.nextLink, moved)) {
+                    v.pos = l.length - v.length / 2;  // wait at the line
+                    v.speed = 0;
+                    break;
+                }
+            }
+            lane.popFront();
+            // a second crossing this tick needs its own room check
+            if (lane.count > 0 && lane.front().nextLink >= 0) {
+                float room;
+                bestLane(lane.front().nextLink, room);
+                canLeave = canLeave && room >= lane.front().length + idm.minGap;
+            }
+        }
+    }
+
+public:
+    // Appends a vehicle that crossed into one of p's links and picks its
+    // next link. Used by deliverPartition and by shards for remote arrivals.
+    void arrive(NetPartition& p, const Transfer& t) {
+        NetLane& lane = lanes[t.lane];
+        if (lane.count == lane.capacity) {
+            p.lost++;
+            return;
+        }
+        NetVehicle vehicle = t.vehicle;
+        float pos = vehicle.length / 2 + vehicle.pos;
+        if (lane.count > 0) {
+            NetVehicle& tail = lane.back();
+            pos = std::min(pos, tail.pos - tail.length / 2 - idm.minGap - vehicle.length / 2);
+        }
+        vehicle.pos = pos;
+        vehicle.nextLink = vehicle.tripLeft > 0 ? chooseNext(t.link, vehicle) : -1;
+        vehicle.tripLeft--;
+        lane.pushBack(vehicle);
+    }
+
+    // Entry space senders check next tick, after this tick's arrivals
+    void publishRoom(int link) {
+        const NetLink& l = links[link];
+        for (int i = l.firstLane; i < l.firstLane + l.laneCount; i++) {
+            NetLane& lane = lanes[i];
+            lane.entryRoom = l.length;
+            if (lane.count > 0) {
+                lane.entryRoom = lane.back().pos - lane.back().length / 2;
+            }
+        }
+    }
+
+private:
+    // Sizes lane rings, node link lists and signal state after parsing
+    void finish() {
+        int ringSlots = 0;
+        for (size_t i = 0; i < links.size(); i++) {
+            NetLink& l = links[i];
+            l.firstLane = lanes.size();
+            l.approach = nodes[l.to].in.size();
+            l.reverse = -1;
+            nodes[l.from].out.push_back(i);
+            nodes[l.to].in.push_back(i);
+            for (int k = 0; k < l.laneCount; k++) {
+                NetLane lane = {};
+                lane.capacity = std::min(MAX_LANE_VEHICLES, (int)(l.length / 20.0f) + 2);
+                lane.entryRoom = l.length;
+                ringSlots += lane.capacity;
+                lanes.push_back(lane);
+            }
+        }
+        for (NetLink& l : links) {
+            for (int out : nodes[l.to].out) {
+                if (links[out].to == l.from) l.reverse = out;
+            }
+        }
+        vehiclePool.assign(ringSlots, NetVehicle());
+        int next = 0;
+        for (NetLane& lane : lanes) {
+            lane.ring = &vehiclePool[next];
+            next += lane.capacity;
+        }
+    }
+
+    static void stepTask(void* arg) {
+        NetPartition* p = (NetPartition*)arg;
+        p->net->stepPartition(*p, p->net->tickDelta);
+    }
+
+    static void deliverTask(void* arg) {
+        NetPartition* p = (NetPartition*)arg;
+        p->net->deliverPartition(*p);
+    }
+
+public:
+    RoadNetwork() : tickDelta(0) {}
+
+    // Returns false with a message on the first malformed line
+    bool load(std::istream& in, std::string& error) {
+        std::unordered_map<int, int> nodeIndex;
+        std::string line;
+        int lineNumber = 0;
+        while (std::getline(in, line)) {
+            lineNumber++;
+            size_t hash = line.find('#');
+            if (hash != std::string::npos) line.erase(hash);
+            std::istringstream words(line);
+            std::string kind;
+            if (!(words >> kind)) continue;
+
+            bool ok = false;
+            if (kind == "node") {
+                NetNode node = {};
+                ok = (bool)(words >> node.id >> node.x >> node.y) && !nodeIndex.count(node.id);
+                if (ok) {
+                    nodeIndex[node.id] = nodes.size();
+                    nodes.push_back(node);
+                }
+            } else if (kind == "link") {
+                int from, to;
+                NetLink link = {};
+                ok = (bool)(words >> from >> to >> link.length >> link.laneCount >> link.speedLimit) &&
+                     nodeIndex.count(from) && nodeIndex.count(to) && from != to &&
+                     link.length > 0 && link.laneCount > 0 && link.speedLimit > 0;
+                if (ok) {
+                    link.from = nodeIndex[from];
+                    link.to = nodeIndex[to];
+                    links.push_back(link);
+                }
+            } else if (kind == "source") {
+                int id;
+                float perMinute;
+                ok = (bool)(words >> id >> perMinute) && nodeIndex.count(id) && perMinute > 0;
+                if (ok) {
+                    nodes[nodeIndex[id]].spawnInterval = 60.0f / perMinute;
+                }
+            }
+            if (!ok) {
+                error = "line " + std::to_string(lineNumber) + ": bad " + kind;
+                return false;
+            }
+        }
+        if (nodes.empty() || links.empty()) {
+            error = "no nodes or links";
+            return false;
+        }
+        finish();
+        return true;
+    }
+
+    bool loadFile(const char* path, std::string& error) {
+        std::ifstream file(path);
+        if (!file) {
+            error = std::string("cannot open ") + path;
+            return false;
+        }
+        return load(file, error);
+    }
+
+    // rows x cols grid of signals, two way links of two lanes, vehicles
+    // entering from every edge node. Much past 8 a minute per edge node
+    // the round robin signals cannot keep up and the grid locks.
+    bool loadGrid(int rows, int cols, std::string& error, float spacing = 300.0f,
+                  float perMinute = 6.0f) {
+        std::ostringstream text;
+        for (int r = 0; r < rows; r++) {
+            for (int c = 0; c < cols; c++) {
+                text << "node " << r * cols + c << " " << c * spacing << " " << r * spacing << "\n";
+            }
+        }
+        for (int r = 0; r < rows; r++) {
+            for (int c = 0; c < cols; c++) {
+                int id = r * cols + c;
+                if (c + 1 < cols) {
+                    text << "link " << id << " " << id + 1 << " " << spacing << " 2 60\n"
+                         << "link " << id + 1 << " " << id << " " << spacing << " 2 60\n";
+                }
+                if (r + 1 < rows) {
+                    text << "link " << id << " " << id + cols << " " << spacing << " 2 60\n"
+                         << "link " << id + cols << " " << id << " " << spacing << " 2 60\n";
+                }
+                if (r == 0 || c == 0 || r == rows - 1 || c == cols - 1) {
+                    text << "source " << id << " " << perMinute << "\n";
+                }
+            }
+        }
+        std::istringstream in(text.str());
+        return load(in, error);
+    }
+
+    // Splits the nodes into about count rectangular tiles by position, so
+    // most links stay inside one partition
+    void partition(int count) {
+        float minX = nodes[0].x, maxX = minX, minY = nodes[0].y, maxY = minY;
+        for (const NetNode& node : nodes) {
+            minX = std::min(minX, node.x);
+            maxX = std::max(maxX, node.x);
+            minY = std::min(minY, node.y);
+            maxY = std::max(maxY, node.y);
+        }
+        int tilesX = std::max(1, (int)std::ceil(std::sqrt((float)count)));
+        int tilesY = std::max(1, (count + tilesX - 1) / tilesX);
+        float tileW = (maxX - minX) / tilesX + 1e-3f;
+        float tileH = (maxY - minY) / tilesY + 1e-3f;
+
+        std::vector<int> remap(tilesX * tilesY, -1);
+        partitions.clear();
+        for (size_t i = 0; i < nodes.size(); i++) {
+            NetNode& node = nodes[i];
+            int tile = std::min(tilesY - 1, (int)((node.y - minY) / tileH)) * tilesX +
+                       std::min(tilesX - 1, (int)((node.x - minX) / tileW));
+            if (remap[tile] < 0) {
+                remap[tile] = partitions.size();
+                partitions.push_back(NetPartition());
+            }
+            node.partition = remap[tile];
+            partitions[node.partition].nodes.push_back(i);
+        }
+
+        for (size_t i = 0; i < partitions.size(); i++) {
+            NetPartition& p = partitions[i];
+            p.net = this;
+            p.index = i;
+            p.outCount = 0;
+            p.idmScratch.assign(5 * MAX_LANE_VEHICLES, 0.0f);
+            p.spawned = p.completed = p.handedOff = p.lost = 0;
+            p.feeders.push_back(i);
+            int outboxSize = 0;
+            for (int n : p.nodes) {
+                for (int link : nodes[n].in) {
+                    p.links.push_back(link);
+                    int feeder = nodes[links[link].from].partition;
+                    if (std::find(p.feeders.begin(), p.feeders.end(), feeder) == p.feeders.end()) {
+                        p.feeders.push_back(feeder);
+                    }
+                }
+                for (int link : nodes[n].out) {
+                    const NetLink& l = links[link];
+                    for (int k = l.firstLane; k < l.firstLane + l.laneCount; k++) {
+                        outboxSize += lanes[k].capacity;
+                    }
+                }
+            }
+            p.outbox.resize(outboxSize);
+        }
+    }
+
+    // Two tasks per partition: step, then deliver once every feeder has
+    // stepped. Partitions only wait on their neighbours, never on a
+    // global barrier. False if the graph does not fit.
+    bool buildTickGraph(TaskGraph& graph) {
+        graph.count = 0;
+        std::vector<int> steps;
+        for (NetPartition& p : partitions) {
+            steps.push_back(graph.add("step partition", stepTask, &p));
+        }
+        for (NetPartition& p : partitions) {
+            int deliver = graph.add("deliver partition", deliverTask, &p);
+            if (deliver < 0 || steps[p.index] < 0) return false;
+            for (int feeder : p.feeders) {
+                if (!graph.precede(steps[feeder], deliver)) return false;
+            }
+        }
+        return true;
+    }
+
+    void stepPartition(NetPartition& p, float dt) {
+        p.outCount = 0;
+        for (int n : p.nodes) {
+            for (int link : nodes[n].out) {
+                const NetLink& l = links[link];
+                for (int k = l.firstLane; k < l.firstLane + l.laneCount; k++) {
+                    lanes[k].claimed = 0;
+                }
+            }
+        }
+        for (int n : p.nodes) {
+            updateSignal(nodes[n], dt);
+            spawnAt(p, nodes[n], dt);
+        }
+        for (int link : p.links) {
+            const NetLink& l = links[link];
+            for (int k = l.firstLane; k < l.firstLane + l.laneCount; k++) {
+                stepLane(p, link, lanes[k], dt);
+            }
+        }
+    }
+
+    void deliverPartition(NetPartition& p) {
+        for (int f : p.feeders) {
+            const NetPartition& feeder = partitions[f];
+            for (int i = 0; i < feeder.outCount; i++) {
+                const Transfer& t = feeder.outbox[i];
+                if (nodes[links[t.link].to].partition == p.index) {
+                    arrive(p, t);
+                }
+            }
+        }
+        for (int link : p.links) {
+            publishRoom(link);
+        }
+    }
+
+    void step(TaskScheduler& scheduler, TaskGraph& graph, float dt) {
+        tickDelta = dt;
+        scheduler.run(graph);
+    }
+
+    // Steps the network for seconds of simulated time on a SimClock, paced
+    // at speed simulated seconds per wall second (0 as fast as the pool
+    // allows), and prints a report. Returns simulated seconds per wall second.
+    float runHeadless(TaskScheduler& scheduler, float seconds, float speed = 0.0f) {
+        TaskGraph* graph = new TaskGraph();
+        if (!buildTickGraph(*graph)) {
+            printf("Too many partitions for one tick graph\n");
+            delete graph;
+            return 0;
+        }
+        SimClock clock(SIM_STEP, speed);
+        const float WARMUP = 60.0f;
+        long warmAllocations = -1;
+        clock.startPacing();
+        while (clock.elapsed() < seconds) {
+            step(scheduler, *graph, clock.step());
+            clock.advance();
+            clock.pace();
+            if (warmAllocations < 0 && clock.elapsed() >= WARMUP) {
+                warmAllocations = heapAllocationCount.load();
+            }
+        }
+        long steadyAllocations = warmAllocations < 0 ? 0 : heapAllocationCount.load() - warmAllocations;
+        double wallSeconds = clock.wallSeconds();
+        float ratio = wallSeconds > 0 ? clock.elapsed() / wallSeconds : 0;
+        delete graph;
+
+        printf("Network run finished\n");
+        clock.printReport();
+        printStats();
+        printf("Heap allocations after warmup: %ld\n", steadyAllocations);
+        printf("Sim seconds / wall second: %.1f\n", ratio);
+        scheduler.printStats();
+        return ratio;
+    }
+
+    long vehiclesOnNetwork() const {
+        long total = 0;
+        for (const NetLane& lane : lanes) total += lane.count;
+        return total;
+    }
+
+    void printStats() const {
+        long spawned = 0, completed = 0, handedOff = 0, lost = 0;
+        size_t largest = 0;
+        for (const NetPartition& p : partitions) {
+            spawned += p.spawned;
+            completed += p.completed;
+            handedOff += p.handedOff;
+            lost += p.lost;
+            largest = std::max(largest, p.nodes.size());
+        }
+        printf("Network: %zu intersections, %zu links, %zu lanes, %zu partitions (largest %zu nodes)\n",
+               nodes.size(), links.size(), lanes.size(), partitions.size(), largest);
+        printf("Vehicles: %ld spawned, %ld trips completed, %ld on the road, %ld lost\n",
+               spawned, completed, vehiclesOnNetwork(), lost);
+        printf("Boundary hand-offs: %ld\n", handedOff);
+    }
+};
+
+#endif
@@ -0,0 +1,331 @@
+#ifndef SHARD_H
+#define SHARD_H
+
+#include "roadnetwork.h"
+#include <atomic>
+#include <pthread.h>
+#include <signal.h>
+#include <sys/mman.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#include <time.h>
+#include <iostream>
+
+// Runs a road network as one process per region (shard) on one host.
+// The coordinator loads the network, partitions it into one region per
+// shard, maps a shared segment and forks the shards. Every tick:
+//
+//   step own region, post crossings to neighbours' mailboxes
+//   ---- barrier ----
+//   drain mailboxes, publish boundary lanes' entry room
+//   ---- barrier ----
+//
+// so all shards stay on the same tick and each phase only reads what
+// the other phase wrote. The coordinator only watches: it prints per
+// shard tick time and imbalance when the shards are done.
+
+// Single producer / single consumer ring of crossings between two shards.
+// Lives in the shared segment; head and tail are lock free atomics.
+struct ShardMailbox {
+    std::atomic<uint32_t> head;  // next to read, consumer side
+    std::atomic<uint32_t> tail;  // next free, producer side
+    uint32_t capacity;
+    uint32_t overflow;           // producer side, crossings that did not fit
+
+    Transfer* slots() { return (Transfer*)(this + 1); }
+
+    bool push(const Transfer& t) {
+        uint32_t at = tail.load(std::memory_order_relaxed);
+        if (at - head.load(std::memory_order_acquire) == capacity) {
+            overflow++;
+            return false;
+        }
+        slots()[at % capacity] = t;
+        tail.store(at + 1, std::memory_order_release);
+        return true;
+    }
+
+    bool pop(Transfer& t) {
+        uint32_t at = head.load(std::memory_order_relaxed);
+        if (at == tail.load(std::memory_order_acquire)) return false;
+        t = slots()[at % capacity];
+        head.store(at + 1, std::memory_order_release);
+        return true;
+    }
+};
+
+// Written by one shard, read by the coordinator
+struct ShardStats {
+    std::atomic<long> ticks;
+    long stepNs;      // stepping the region
+    long exchangeNs;  // posting, draining and publishing boundary state
+    long waitNs;      // blocked in the barriers
+    long slowestTickNs;
+    long overruns;    // ticks over their budget when paced
+    long sent;        // crossings posted to other shards
+    long received;
+    long spawned;
+    long completed;
+    long lost;
+    int exitCode;
+};
+
+class ShardCoordinator {
+private:
+    struct Route {
+        int from, to;   // shards
+        size_t offset;  // mailbox position in the segment
+        uint32_t capacity;
+    };
+
+    RoadNetwork& network;
+    int shardCount;
+    std::vector<Route> routes;
+    std::vector<int> boundaryLanes;  // lanes fed from another shard
+    char* segment;
+    size_t segmentSize;
+    pthread_barrier_t* barrier;
+    ShardStats* stats;
+    float* entryRoom;  // shared copy for boundary lanes, by lane index
+
+    static long nowNs() {
+        timespec now;
+        clock_gettime(CLOCK_MONOTONIC, &now);
+        return now.tv_sec * 1000000000L + now.tv_nsec;
+    }
+
+    ShardMailbox* mailbox(int from, int to) {
+        for (const Route& route : routes) {
+            if (route.from == from && route.to == to) {
+                return (ShardMailbox*)(segment + route.offset);
+            }
+        }
+        return NULL;
+    }
+
+    // Mailboxes hold every ring slot of the links one shard feeds in the
+    // other, so a tick's crossings always fit
+    void layout() {
+        auto align = [](size_t n) { return (n + 63) & ~(size_t)63; };
+        size_t offset = align(sizeof(pthread_barrier_t));
+        size_t statsOffset = offset;
+        offset = align(offset + sizeof(ShardStats) * shardCount);
+        size_t roomOffset = offset;
+        offset = align(offset + sizeof(float) * network.lanes.size());
+
+        for (int to = 0; to < shardCount; to++) {
+            for (int from : network.partitions[to].feeders) {
+                if (from == to) continue;
+                uint32_t capacity = 0;
+                for (int link : network.partitions[to].links) {
+                    const NetLink& l = network.links[link];
+                    if (network.nodes[l.from].partition != from) continue;
+                    for (int k = l.firstLane; k < l.firstLane + l.laneCount; k++) {
+                        capacity += network.lanes[k].capacity;
+                        boundaryLanes.push_back(k);
+                    }
+                }
+                routes.push_back({from, to, offset, capacity});
+                offset = align(offset + sizeof(ShardMailbox) + sizeof(Transfer) * capacity);
+            }
+        }
+        segmentSize = offset;
+        segment = (char*)mmap(NULL, segmentSize, PROT_READ | PROT_WRITE,
+                              MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+        if (segment == MAP_FAILED) {
+            segment = NULL;
+            return;
+        }
+        barrier = (pthread_barrier_t*)segment;
+        stats = (ShardStats*)(segment + statsOffset);
+        entryRoom = (float*)(segment + roomOffset);
+        for (size_t i = 0; i < network.lanes.size(); i++) {
+            entryRoom[i] = network.lanes[i].entryRoom;
+        }
+        for (const Route& route : routes) {
+            ((ShardMailbox*)(segment + route.offset))->capacity = route.capacity;
+        }
+
+        pthread_barrierattr_t attr;
+        pthread_barrierattr_init(&attr);
+        pthread_barrierattr_setpshared(&attr, PTHREAD_PROCESS_SHARED);
+        pthread_barrier_init(barrier, &attr, shardCount);
+        pthread_barrierattr_destroy(&attr);
+    }
+
+    long waitBarrier() {
+        long start = nowNs();
+        pthread_barrier_wait(barrier);
+        return nowNs() - start;
+    }
+
+    // Body of shard process s. Every shard runs the same clock and the
+    // barriers keep them on the same tick.
+    int runShard(int s, float seconds, float speed) {
+        NetPartition& region = network.partitions[s];
+        ShardStats& mine = stats[s];
+        SimClock clock(SIM_STEP, speed);
+        clock.startPacing();
+        while (clock.elapsed() < seconds) {
+            long tickStart = nowNs();
+
+            // boundary room the owners published last tick
+            for (int lane : boundaryLanes) {
+                network.lanes[lane].entryRoom = entryRoom[lane];
+            }
+            network.tickDelta = clock.step();
+            network.stepPartition(region, clock.step());
+            long stepped = nowNs();
+
+            for (int i = 0; i < region.outCount; i++) {
+                const Transfer& t = region.outbox[i];
+                int owner = network.nodes[network.links[t.link].to].partition;
+                // every link crossing shards got a route in the constructor
+                ShardMailbox* box = owner != s ? mailbox(s, owner) : NULL;
+                if (box) {
+                    box->push(t);
+                    mine.sent++;
+                }
+            }
+            long posted = nowNs();
+            mine.waitNs += waitBarrier();
+            long exchangeStart = nowNs();
+
+            for (int i = 0; i < region.outCount; i++) {
+                const Transfer& t = region.outbox[i];
+                if (network.nodes[network.links[t.link].to].partition == s) {
+                    network.arrive(region, t);
+                }
+            }
+            for (int from : region.feeders) {
+                if (from == s) continue;
+                ShardMailbox* box = mailbox(from, s);
+                Transfer t;
+                while (box->pop(t)) {
+                    network.arrive(region, t);
+                    mine.received++;
+                }
+            }
+            for (int link : region.links) {
+                network.publishRoom(link);
+                const NetLink& l = network.links[link];
+                for (int k = l.firstLane; k < l.firstLane + l.laneCount; k++) {
+                    entryRoom[k] = network.lanes[k].entryRoom;
+                }
+            }
+            long exchanged = nowNs();
+            mine.waitNs += waitBarrier();
+
+            long tickNs = (stepped - tickStart) + (posted - stepped) + (exchanged - exchangeStart);
+            mine.stepNs += stepped - tickStart;
+            mine.exchangeNs += (posted - stepped) + (exchanged - exchangeStart);
+            mine.slowestTickNs = std::max(mine.slowestTickNs, tickNs);
+            clock.advance();
+            mine.ticks.store(clock.tick(), std::memory_order_relaxed);
+            clock.pace();
+        }
+        mine.overruns = clock.overrunCount();
+        mine.spawned = region.spawned;
+        mine.completed = region.completed;
+        mine.lost = region.lost;
+        for (const Route& route : routes) {
+            if (route.from == s) mine.lost += ((ShardMailbox*)(segment + route.offset))->overflow;
+        }
+        return 0;
+    }
+
+public:
+    ShardCoordinator(RoadNetwork& network, int shards)
+        : network(network), shardCount(shards), segment(NULL), segmentSize(0) {
+        network.partition(shards);
+        shardCount = network.partitions.size();  // empty tiles are dropped
+        layout();
+    }
+
+    ~ShardCoordinator() {
+        if (segment) {
+            pthread_barrier_destroy(barrier);
+            munmap(segment, segmentSize);
+        }
+    }
+
+    // Forks the shards, waits for them and prints the report. If a shard
+    // dies the rest would block in the barrier forever, so they are killed.
+    // speed paces the shards like SimClock, 0 runs them as fast as possible.
+    bool run(float seconds, float speed = 0.0f) {
+        if (!segment) {
+            perror("mmap");
+            return false;
+        }
+        std::vector<pid_t> children(shardCount, -1);
+        long wallStart = nowNs();
+        for (int s = 0; s < shardCount; s++) {
+            pid_t pid = fork();
+            if (pid == 0) {
+                _exit(runShard(s, seconds, speed));
+            } else if (pid < 0) {
+                perror("fork");
+                for (int k = 0; k < s; k++) kill(children[k], SIGKILL);
+                return false;
+            }
+            children[s] = pid;
+        }
+
+        bool ok = true;
+        for (int done = 0; done < shardCount; done++) {
+            int status;
+            pid_t pid = wait(&status);
+            for (int s = 0; s < shardCount; s++) {
+                if (children[s] != pid) continue;
+                stats[s].exitCode = WIFEXITED(status) ? WEXITSTATUS(status) : -1;
+                if (stats[s].exitCode != 0 && ok) {
+                    ok = false;
+                    std::cerr << "Shard " << s << " failed, stopping the others" << std::endl;
+                    for (int k = 0; k < shardCount; k++) {
+                        if (k != s) kill(children[k], SIGKILL);
+                    }
+                }
+            }
+        }
+        double wallSeconds = (nowNs() - wallStart) / 1e9;
+        printReport(seconds, wallSeconds);
+        return ok;
+    }
+
+    void printReport(float seconds, double wallSeconds) const {
+        double totalWork = 0, slowest = 0;
+        long sent = 0, spawned = 0, completed = 0, lost = 0, ticks = 0;
+        for (int s = 0; s < shardCount; s++) {
+            ticks = std::max(ticks, stats[s].ticks.load());
+            double work = stats[s].stepNs + stats[s].exchangeNs;
+            totalWork += work;
+            slowest = std::max(slowest, work);
+            sent += stats[s].sent;
+            spawned += stats[s].spawned;
+            completed += stats[s].completed;
+            lost += stats[s].lost;
+        }
+        double mean = totalWork / shardCount;
+
+        printf("Sharded run: %d shards, %zu intersections, %zu links, %.1f KB shared\n",
+               shardCount, network.nodes.size(), network.links.size(), segmentSize / 1024.0);
+        printf("shard  nodes  ticks     step us/tick  exchange us/tick  wait us/tick  slowest us  overruns  sent    received\n");
+        for (int s = 0; s < shardCount; s++) {
+            const ShardStats& st = stats[s];
+            double ticks = st.ticks > 0 ? (double)st.ticks : 1.0;
+            printf("%5d  %5zu  %8ld  %12.1f  %16.1f  %12.1f  %10.1f  %8ld  %6ld  %8ld\n", s,
+                   network.partitions[s].nodes.size(), st.ticks.load(), st.stepNs / ticks / 1e3,
+                   st.exchangeNs / ticks / 1e3, st.waitNs / ticks / 1e3, st.slowestTickNs / 1e3,
+                   st.overruns, st.sent, st.received);
+        }
+        printf("Imbalance (slowest / mean shard work): %.2f\n", mean > 0 ? slowest / mean : 0.0);
+        printf("Vehicles: %ld spawned, %ld trips completed, %ld boundary crossings, %ld lost\n",
+               spawned, completed, sent, lost);
+        // from the ticks actually stepped, a killed or failed run stops short
+        double simulated = ticks * (double)SIM_STEP;
+        printf("Simulated seconds: %.1f of %.1f\n", simulated, seconds);
+        printf("Sim seconds / wall second: %.1f\n", wallSeconds > 0 ? simulated / wallSeconds : 0.0);
+    }
+};
+
+#endif
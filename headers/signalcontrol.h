@@ -0,0 +1,102 @@
+#ifndef SIGNALCONTROL_H
+#define SIGNALCONTROL_H
+
+#include <string>
+
+// What a controller sees of one approach. The count is kept up to date
+// by spawning and the lane update as vehicles arrive and cross, so
+// reading it is O(1) per approach.
+struct ApproachState {
+    int waiting;  // vehicles that have not crossed the stop line yet
+};
+
+// Decides the green phase of one intersection. Called once a tick while
+// an approach is green (never during yellow) with how long it has been
+// green. Returns the approach to switch to, or green to keep it; the
+// caller runs the yellow in between.
+class SignalController {
+public:
+    virtual ~SignalController() {}
+    virtual const char* name() const = 0;
+    virtual int decide(int green, float greenTime, const ApproachState* approaches, int count) = 0;
+};
+
+// The original plan: every approach in turn for a fixed time, whether or
+// not anyone is waiting
+class FixedTimeController : public SignalController {
+private:
+    float interval;
+
+public:
+    FixedTimeController(float interval = 10.0f) : interval(interval) {}
+
+    const char* name() const { return "fixed"; }
+
+    int decide(int green, float greenTime, const ApproachState*, int count) {
+        return greenTime >= interval ? (green + 1) % count : green;
+    }
+};
+
+// Round robin that skips empty approaches and ends a green early once
+// its queue has cleared (gap out), or at maxGreen if others are waiting
+class ActuatedController : public SignalController {
+private:
+    float minGreen;
+    float maxGreen;
+
+public:
+    ActuatedController(float minGreen = 4.0f, float maxGreen = 20.0f)
+        : minGreen(minGreen), maxGreen(maxGreen) {}
+
+    const char* name() const { return "actuated"; }
+
+    int decide(int green, float greenTime, const ApproachState* approaches, int count) {
+        if (greenTime < minGreen) return green;
+        bool cleared = approaches[green].waiting == 0;
+        if (!cleared && greenTime < maxGreen) return green;
+        for (int k = 1; k < count; k++) {
+            int next = (green + k) % count;
+            if (approaches[next].waiting > 0) return next;
+        }
+        return green;  // nobody else waiting, stay green
+    }
+};
+
+// Max pressure: after minGreen, switch to the approach with the longest
+// queue once it beats the green one by margin vehicles. Vehicles leave
+// the crossroads onto free exit roads, so an approach's pressure is just
+// its queue.
+class MaxPressureController : public SignalController {
+private:
+    float minGreen;
+    int margin;
+
+public:
+    MaxPressureController(float minGreen = 4.0f, int margin = 2)
+        : minGreen(minGreen), margin(margin) {}
+
+    const char* name() const { return "pressure"; }
+
+    int decide(int green, float greenTime, const ApproachState* approaches, int count) {
+        if (greenTime < minGreen) return green;
+        int best = green;
+        for (int k = 1; k < count; k++) {
+            int next = (green + k) % count;
+            if (approaches[next].waiting > approaches[best].waiting) best = next;
+        }
+        if (best != green && approaches[best].waiting >= approaches[green].waiting + margin) {
+            return best;
+        }
+        return green;
+    }
+};
+
+// By command line name, NULL if unknown
+inline SignalController* makeSignalController(const std::string& name) {
+    if (name == "fixed") return new FixedTimeController();
+    if (name == "actuated") return new ActuatedController();
+    if (name == "pressure") return new MaxPressureController();
+    return NULL;
+}
+
+#endif
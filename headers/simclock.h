@@ -0,0 +1,123 @@
+#ifndef SIMCLOCK_H
+#define SIMCLOCK_H
+
+#include <stdint.h>
+#include <time.h>
+#include <errno.h>
+#include <cstdio>
+
+// The one clock a run advances. Every tick is the same fixed step, so
+// signals, spawners and lanes all integrate the same dt and a run does
+// not depend on how long the machine took for the last frame. Simulated
+// time is ticks * step, never a float sum.
+//
+// Wall time only matters for pacing: with compression c a tick is due
+// step / c wall seconds after the previous one, 0 runs as fast as
+// possible. A tick whose work took longer than that is an overrun.
+class SimClock {
+private:
+    float stepSeconds;
+    float compression;  // simulated seconds per wall second, 0 for no pacing
+    uint32_t ticks;
+    time_t startClock;
+    float clockScale;   // clock seconds per simulated second
+
+    // pacing, wall nanoseconds
+    long startNs;
+    long deadlineNs;    // when the next tick is due
+    long lastNs;        // end of the previous pace()
+    long overruns;
+    long resyncs;
+    long worstTickNs;
+
+    static long nowNs() {
+        timespec now;
+        clock_gettime(CLOCK_MONOTONIC, &now);
+        return now.tv_sec * 1000000000L + now.tv_nsec;
+    }
+
+    long budgetNs() const {
+        return (long)(stepSeconds / compression * 1e9);
+    }
+
+public:
+    SimClock(float step, float compression = 1.0f)
+        : stepSeconds(step), compression(compression), ticks(0), startClock(0),
+          clockScale(1.0f), startNs(0), deadlineNs(0), lastNs(0), overruns(0),
+          resyncs(0), worstTickNs(0) {}
+
+    // Clock shown to the user and read by the spawner for peak hours
+    void setStartClock(time_t start, float scale) {
+        startClock = start;
+        clockScale = scale;
+    }
+
+    void setCompression(float factor) {
+        compression = factor < 0 ? 0 : factor;
+    }
+
+    float step() const { return stepSeconds; }
+    uint32_t tick() const { return ticks; }
+    float speed() const { return compression; }
+    long overrunCount() const { return overruns; }
+
+    double elapsed() const {
+        return ticks * (double)stepSeconds;
+    }
+
+    time_t clockTime() const {
+        return startClock + (time_t)(elapsed() * clockScale);
+    }
+
+    // Marks the start of wall time pacing, call right before the first tick
+    void startPacing() {
+        startNs = lastNs = deadlineNs = nowNs();
+    }
+
+    // After a tick's work, in lockstep for every subsystem
+    void advance() {
+        ticks++;
+    }
+
+    // Sleeps until the next tick is due. Falling more than a quarter
+    // second behind restarts the schedule rather than bursting to catch up.
+    void pace() {
+        long now = nowNs();
+        long spent = now - lastNs;
+        if (spent > worstTickNs) worstTickNs = spent;
+        if (compression > 0) {
+            long budget = budgetNs();
+            if (spent > budget) overruns++;
+            deadlineNs += budget;
+            if (now - deadlineNs > 250000000L) {
+                deadlineNs = now;
+                resyncs++;
+            }
+            timespec due;
+            due.tv_sec = deadlineNs / 1000000000L;
+            due.tv_nsec = deadlineNs % 1000000000L;
+            while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &due, NULL) == EINTR) {}
+        }
+        lastNs = nowNs();
+    }
+
+    double wallSeconds() const {
+        return (nowNs() - startNs) / 1e9;
+    }
+
+    void printReport() const {
+        double wall = wallSeconds();
+        printf("Clock: %u ticks of %.1f ms, %.1f s simulated in %.2f s wall (%.1fx",
+               ticks, stepSeconds * 1e3, elapsed(), wall, wall > 0 ? elapsed() / wall : 0.0);
+        if (compression > 0) {
+            printf(", target %.1fx)\n", compression);
+            printf("  overruns: %ld ticks over their %.2f ms budget (%.1f%%), %ld resyncs, slowest %.2f ms\n",
+                   overruns, budgetNs() / 1e6, ticks ? 100.0 * overruns / ticks : 0.0, resyncs,
+                   worstTickNs / 1e6);
+        } else {
+            printf(", unpaced)\n  slowest tick %.2f ms\n", worstTickNs / 1e6);
+        }
+    }
+};
+
+#endif
@@ -1,63 +1,95 @@
 #include "vehiclespawner.h"
 #include "trafficmanager.h"
-#include <semaphore.h>
+#include "taskscheduler.h"
+#include "idm.h"
+#include "simclock.h"
+#include "collision.h"
+#include "metrics.h"
 #include <iomanip>
+#include <chrono>
 
+// What one direction's tick tasks work on
 struct ThreadData {
-    std::vector<Vehicle*>* vehicles;
+    VehicleTable* vehicles;
     VehicleSpawner* spawner;
     int direction;
-    bool* running;
-    pthread_mutex_t* mutex;
-    float* simulationTime;
     TrafficManager* trafficManager;
-    sem_t* intersectionSem;
+    CarFollowingMode* carFollowing;
+    const IdmParams* idm;
+    const SimClock* clock;   // fixed step, and the tick that keys random draws
 };
 
 class Simulation {
 public:
-    pthread_t threads[4];
-    pthread_t trafficThread;
-    pthread_mutex_t vehicleMutex;
-    sem_t intersectionSemaphore;
-    bool isRunning;
+    TaskScheduler scheduler;  // runs tickGraph once per tick
+    TaskGraph tickGraph;
+    pthread_t tickThread;     // paces ticks in real time when windowed
+    std::atomic<bool> isRunning;
+    bool threadsStarted;
+    SimClock clock;           // every task reads step and tick from here
+    float duration;           // simulated seconds to run
     ThreadData threadData[4];
-    std::map<int, std::vector<Vehicle*>> directionVehicles;
+    VehicleTable directionVehicles[4];
+    SnapshotBuffer snapshots;  // what the windows draw, see publishTask
+    sf::Sprite vehicleSprite;  // reused for every vehicle at draw time
     TrafficManager trafficManager;
-    time_t simulationStartTime;
-    float timeMultiplier;
+    CollisionDetector collisions;  // cross-direction overlaps, see collisionTask
     sf::Font font;
     sf::Text timeText;
+    time_t shownTime;  // clock value timeText was last formatted from
     sf::VideoMode resolution;
     sf::RenderWindow window;
     VehicleSpawner spawner;
-    sf::Clock clock;
-    float simulationTime;
+    bool headless;
+    CarFollowingMode carFollowing;
+    IdmParams idmParams;
 
-    Simulation() : 
-        resolution(WIDTH, HEIGHT),
-        window(resolution, "SmartTraffix"),
-        simulationTime(0.0f),
+    // exported metrics, no-ops until enableMetrics()
+    Histogram tickTime;
+    Gauge laneVehicles[4][2];
+    Gauge outboxDepth;
+
+    // workers 0 means one per hardware thread
+    Simulation(bool headless = false, int workers = 0) : 
+        scheduler(workers),
         isRunning(true),
-        trafficManager(&vehicleMutex) {
+        threadsStarted(false),
+        clock(SIM_STEP, headless ? 0.0f : 1.0f),
+        duration(SIMTIME),
+        trafficManager(headless),
+        shownTime(0),
+        resolution(WIDTH, HEIGHT),
+        headless(headless),
+        carFollowing(FOLLOW_CLASSIC) {
         
-        // limit fps to 60, more than enough for traffic sim
-        window.setFramerateLimit(60);
-        pthread_mutex_init(&vehicleMutex, NULL);
-        sem_init(&intersectionSemaphore, 0, 1);
+        if (!headless) {
+            window.create(resolution, "SmartTraffix");
+            // limit fps to 60, more than enough for traffic sim
+            window.setFramerateLimit(60);
+        }
+        // one atlas for every vehicle, headless only needs the sizes
+        if (!TextureCache::instance().build(!headless)) {
+            std::cerr << "Failed to load vehicle textures, drawing vehicles untextured." << std::endl;
+        }
         
-        // setup data for each direction thread
+        // setup data for each direction's tasks
         for(int i = 0; i < 4; i++) {
-            directionVehicles[i] = std::vector<Vehicle*>();
+            directionVehicles[i].direction = i;
             threadData[i].vehicles = &directionVehicles[i];
             threadData[i].spawner = &spawner;
             threadData[i].direction = i;
-            threadData[i].running = &isRunning;
-            threadData[i].mutex = &vehicleMutex;
-            threadData[i].simulationTime = &simulationTime;
             threadData[i].trafficManager = &trafficManager;
-            threadData[i].intersectionSem = &intersectionSemaphore;
+            threadData[i].carFollowing = &carFollowing;
+            threadData[i].idm = &idmParams;
+            threadData[i].clock = &clock;
+        }
+        std::vector<VehicleTable*> tables;
+        for(int i = 0; i < 4; i++) {
+            tables.push_back(&directionVehicles[i]);
         }
+        spawner.setVehicles(tables);
+        buildTickGraph();
+        Instrumentation::installSignalHandler();
     }
     
     void initializeTime() {
@@ -136,9 +168,8 @@ public:
         timeinfo->tm_hour = hours;
         timeinfo->tm_min = minutes;
         timeinfo->tm_sec = 0;
-        simulationStartTime = mktime(timeinfo);
-        timeMultiplier = 60.0f;  // 1 sec = 1 min
-        spawner.setCurrentTime(simulationStartTime);
+        clock.setStartClock(mktime(timeinfo), CLOCK_SCALE);
+        spawner.setCurrentTime(clock.clockTime());
 
         // Setup time display
         timeText.setFont(font);
@@ -147,13 +178,13 @@ public:
         timeText.setPosition(10, 10);
     }   
 
-    void updateSimulationTime(float deltaTime) {
-        // update the fake time - multiply by 60 bc 1sec = 1min
-        simulationStartTime += time_t(deltaTime * timeMultiplier);
-        spawner.setCurrentTime(simulationStartTime);
+    // Render thread, formats the clock of the snapshot being drawn
+    void showTime(time_t clockTime) {
+        if (clockTime == shownTime) return;
+        shownTime = clockTime;
         
         // tome format
-        struct tm* timeinfo = localtime(&simulationStartTime);
+        struct tm* timeinfo = localtime(&clockTime);
         std::stringstream ss;
         ss << "Time: " 
            << std::setfill('0') << std::setw(2) << timeinfo->tm_hour << ":"
@@ -162,190 +193,404 @@ public:
         timeText.setString(ss.str());
     }
 
-    static void* trafficControlThread(void* arg) {
-        Simulation* sim = (Simulation*)arg;
-        sf::Clock threadClock;
+    // Copies what the windows need out of the tables, runs after every
+    // other task of the tick. Rendering works from the published copy.
+    void captureSnapshot(WorldSnapshot& snapshot) {
+        int n = 0;
+        for(const auto& table : directionVehicles) {
+            for(int i = 0; i < VehicleTable::CAPACITY; i++) {
+                if(!table.alive(i)) continue;
+                VehicleSnapshot& vehicle = snapshot.vehicles[n++];
+                vehicle.x = table.posX[i];
+                vehicle.y = table.posY[i];
+                vehicle.skin = table.skin[i];
+                vehicle.direction = table.direction;
+            }
+        }
+        snapshot.vehicleCount = n;
+        snapshot.clock = clock.clockTime();
+        trafficManager.captureLights(snapshot);
+    }
+
+    static void updateLaneClassic(ThreadData* data, int l, float deltaTime, bool isGreenLight) {
+        VehicleTable& table = *data->vehicles;
+        const LaneQueue& queue = table.lanes[l];
         
-        // main loop for traffic lights
-        while(sim->isRunning && sim->simulationTime < SIMTIME) {
-            float deltaTime = threadClock.restart().asSeconds();
+        // front to back, so every leader has moved before its follower
+        for(int k = 0; k < queue.size(); k++) {
+            int i = queue.at(k);
+            int ahead = table.leader[i];
             
-            // need mutex here to safely update traffic lights
-            pthread_mutex_lock(&sim->vehicleMutex);
-            sim->trafficManager.update(deltaTime);
-            sim->trafficManager.updateAndRender(sim->directionVehicles);
-            pthread_mutex_unlock(&sim->vehicleMutex);
+            float SAFE_DISTANCE = table.length[i] * 1.5f;
+            if (table.isHeavy(i)) {
+                SAFE_DISTANCE *= 0.75f;
+            }
             
-            // small sleep to prevent thread from hogging cpu
-            sf::sleep(sf::milliseconds(16));
+            float minSafeSpeed = table.maxSpeed[i];
+            if(ahead >= 0) {
+                float distance = table.along(ahead) - table.along(i);
+                if(distance > 0 && distance < SAFE_DISTANCE) {
+                    minSafeSpeed = std::min(minSafeSpeed, table.currentSpeed[ahead] * 0.5f);
+                }
+            }
+            
+            table.currentSpeed[i] = minSafeSpeed;
+            table.update(i, deltaTime, isGreenLight, data->clock->tick());
+            table.trackStopped(i);
+            
+            // never pass the leader, keeps the lane queue in road order
+            if(ahead >= 0) {
+                float limit = table.along(ahead) - (table.length[ahead] + table.length[i]) / 2;
+                if(table.along(i) > limit) {
+                    table.setAlong(i, limit);
+                }
+            }
         }
-        return NULL;
     }
 
-
-    static void updateVehicles(ThreadData* data, float deltaTime) {
-        bool isGreenLight = data->trafficManager->isGreen(data->direction);
+    // IDM step for one lane: pack gap/speed/closing rate/desired speed in
+    // road order, get all accelerations from one kernel call, then move.
+    // A red light is a stopped leader at the stop line.
+    static void updateLaneIdm(ThreadData* data, int l, float deltaTime, bool isGreenLight) {
+        VehicleTable& table = *data->vehicles;
+        const LaneQueue& queue = table.lanes[l];
+        const int n = queue.size();
+        if(n == 0) return;
+        const float stopLine = table.stopLine();
+        // zeroed so the kernel never sees an unset input, whatever n is
+        float gap[LaneQueue::CAPACITY] = {};
+        float speed[LaneQueue::CAPACITY] = {};
+        float dv[LaneQueue::CAPACITY] = {};
+        float desired[LaneQueue::CAPACITY] = {};
+        float accel[LaneQueue::CAPACITY];
         
-        auto it = data->vehicles->begin();
-        while(it != data->vehicles->end()) {
-            Vehicle* currentVehicle = *it;
+        for(int k = 0; k < n; k++) {
+            int i = queue.at(k);
+            int ahead = table.leader[i];
+            float front = table.along(i) + table.length[i] / 2;
             
-            float minSafeSpeed = currentVehicle->maxSpeed;
-            for(auto& otherVehicle : *(data->vehicles)) {
-                if(currentVehicle != otherVehicle && 
-                   currentVehicle->lane == otherVehicle->lane) {
-                    sf::Vector2f pos1 = currentVehicle->veh.getPosition();
-                    sf::Vector2f pos2 = otherVehicle->veh.getPosition();
-                    float distance = 0;
-                    
-                    switch(data->direction) {
-                        case 0:
-                            distance = pos2.y - pos1.y;
-                            break;
-                        case 1:
-                            distance = pos2.x - pos1.x;
-                            break;
-                        case 2:
-                            distance = pos1.y - pos2.y;
-                            break;
-                        case 3:
-                            distance = pos1.x - pos2.x;
-                            break;
-                    }
-                    float SAFE_DISTANCE;
-                    switch(currentVehicle->direction){
-                        case 0:
-                        case 2:
-                            SAFE_DISTANCE = currentVehicle->veh.getGlobalBounds().height * 1.5f;
-                            break;
-                        case 1:
-                        case 3:
-                            SAFE_DISTANCE = currentVehicle->veh.getGlobalBounds().width * 1.5f;
-                            break;
-                    }
-                    if (currentVehicle->isHeavy) {
-                        SAFE_DISTANCE *= 0.75f;
-                    }
-                    
-                    if(distance > 0 && distance < SAFE_DISTANCE) {
-                        minSafeSpeed = std::min(minSafeSpeed, otherVehicle->currentSpeed * 0.5f);
-                    }
+            speed[k] = table.currentSpeed[i];
+            desired[k] = table.desiredSpeed[i];
+            gap[k] = IDM_FREE_GAP;
+            dv[k] = 0;
+            if(ahead >= 0) {
+                gap[k] = table.along(ahead) - table.length[ahead] / 2 - front;
+                dv[k] = speed[k] - table.currentSpeed[ahead];
+            }
+            if(!isGreenLight && !table.isEmergency(i)) {
+                float toLine = stopLine - front;
+                if(toLine >= 0 && toLine < gap[k]) {
+                    gap[k] = toLine;
+                    dv[k] = speed[k];
                 }
             }
+            gap[k] = std::max(gap[k], 0.1f);
+        }
+        
+        idmAccelerations(gap, speed, dv, desired, accel, n, *data->idm);
+        
+        for(int k = 0; k < n; k++) {
+            int i = queue.at(k);
+            float v = std::max(0.0f, speed[k] + accel[k] * deltaTime);
+            table.currentSpeed[i] = v;
+            table.trackStopped(i);
+            float next = table.along(i) + v * deltaTime;
             
-            currentVehicle->currentSpeed = minSafeSpeed;
-            currentVehicle->update(deltaTime, isGreenLight);
+            int ahead = table.leader[i];
+            if(ahead >= 0) {
+                float limit = table.along(ahead) - (table.length[ahead] + table.length[i]) / 2;
+                next = std::min(next, limit);
+            }
+            table.setAlong(i, next);
+        }
+    }
+
+    static void updateVehicles(ThreadData* data, float deltaTime) {
+        bool isGreenLight = data->trafficManager->isGreen(data->direction);
+        VehicleTable& table = *data->vehicles;
+        TrafficStats& stats = data->trafficManager->stats;
+        
+        for(int l = 0; l < 2; l++) {
+            const LaneQueue& queue = table.lanes[l];
+            if(*data->carFollowing == FOLLOW_IDM) {
+                updateLaneIdm(data, l, deltaTime, isGreenLight);
+            } else {
+                updateLaneClassic(data, l, deltaTime, isGreenLight);
+            }
+            long departures = table.departures;
+            table.trackPassed(l);
+            stats.onDepartures(data->direction, table.departures - departures);
             
-            sf::Vector2f pos = currentVehicle->veh.getPosition();
-            if(pos.x < -50 || pos.x > WIDTH + 50 || 
-               pos.y < -50 || pos.y > HEIGHT + 50) {
-                data->spawner->decrementLaneCount(data->direction, currentVehicle->lane);
+            // vehicles leave the screen from the front of the lane
+            while(!queue.empty()) {
+                int i = queue.front();
+                float x = table.posX[i], y = table.posY[i];
+                if(x >= -50 && x <= WIDTH + 50 && 
+                   y >= -50 && y <= HEIGHT + 50) {
+                    break;
+                }
+                data->spawner->decrementLaneCount(data->direction, table.lane[i]);
                 
-                if (!currentVehicle->isEmergency) {
-                    std::string vehicleType = currentVehicle->isHeavy ? "Heavy" : "Light";
-                    if (!data->spawner->isQueueFull(currentVehicle->direction)) {
-                        data->spawner->addToPendingQueue(vehicleType, currentVehicle->direction);
+                if (!table.isEmergency(i)) {
+                    std::string vehicleType = table.isHeavy(i) ? "Heavy" : "Light";
+                    if (!data->spawner->isQueueFull(data->direction)) {
+                        data->spawner->addToPendingQueue(vehicleType, data->direction);
                     }
                 }
                 
-                delete currentVehicle;
-                it = data->vehicles->erase(it);
-            } else {
-                ++it;
+                data->trafficManager->closeViolation(table, i);
+                stats.onDespawn(data->direction, table.lane[i], table.type[i],
+                                table.flags[i] & FLAG_CHALLAN);
+                table.release(i);
             }
         }
+        table.delaySeconds += table.stoppedCount * deltaTime;
     }
 
+    // Takes a free table row for a new vehicle, false if there is no room
+    static bool addVehicle(ThreadData* data, const std::string& type, int lane) {
+        if (!data->spawner->isLaneAvailable(data->direction, lane)) {
+            return false;
+        }
+        int slot = data->vehicles->spawn(type, lane, data->clock->tick());
+        if (slot < 0) {
+            return false;
+        }
+        data->trafficManager->stats.onSpawn(data->direction, lane, data->vehicles->type[slot]);
+        data->spawner->incrementLaneCount(data->direction, lane);
+        return true;
+    }
+    // Every draw of a direction's spawn task comes from one stream keyed
+    // by direction and tick, so the order other tasks run in cannot
+    // change what is drawn
     static void spawnVehicles(ThreadData* data, float deltaTime) {
+        RandomStream rng(RNG_SPAWNER, data->direction, data->clock->tick());
         if (data->spawner->hasPendingVehicles(data->direction)) {
             PendingVehicle pending = data->spawner->getNextPendingVehicle(data->direction);
             int lane;
             
             if (pending.type == "Heavy") {
-                if (data->spawner->isLaneAvailable(data->direction, 2)) {
-                    Vehicle* vehicle = new Vehicle(pending.type, data->direction, 2);
-                    data->vehicles->push_back(vehicle);
-                    data->spawner->incrementLaneCount(data->direction, 2);
-                } else {
+                if (!addVehicle(data, pending.type, 2)) {
                     data->spawner->addToPendingQueue(pending.type, data->direction);
                 }
             } else {
-                lane = data->spawner->getLeastOccupiedLane(data->direction);
-                if (data->spawner->isLaneAvailable(data->direction, lane)) {
-                    Vehicle* vehicle = new Vehicle(pending.type, data->direction, lane);
-                    data->vehicles->push_back(vehicle);
-                    data->spawner->incrementLaneCount(data->direction, lane);
-                } else {
+                lane = data->spawner->getLeastOccupiedLane(data->direction, rng);
+                if (!addVehicle(data, pending.type, lane)) {
                     data->spawner->addToPendingQueue(pending.type, data->direction);
                 }
             }
         }
         
-        if(data->spawner->shouldSpawnHeavyVehicle(data->direction, deltaTime)) {
-            if (data->spawner->isLaneAvailable(data->direction, 2)) {
-                Vehicle* vehicle = new Vehicle("Heavy", data->direction, 2);
-                data->vehicles->push_back(vehicle);
-                data->spawner->incrementLaneCount(data->direction, 2);
-            }
+        if(data->spawner->shouldSpawnHeavyVehicle(data->direction, deltaTime, rng)) {
+            addVehicle(data, "Heavy", 2);
         }
-        else if(data->spawner->shouldSpawnEmergency(data->direction, deltaTime)) {
-            int lane = data->spawner->getLeastOccupiedLane(data->direction);
-            if (data->spawner->isLaneAvailable(data->direction, lane)) {
-                Vehicle* vehicle = new Vehicle("Emergency", data->direction, lane);
-                data->vehicles->push_back(vehicle);
-                data->spawner->incrementLaneCount(data->direction, lane);
-            }
+        else if(data->spawner->shouldSpawnEmergency(data->direction, deltaTime, rng)) {
+            addVehicle(data, "Emergency", data->spawner->getLeastOccupiedLane(data->direction, rng));
         }
         else if(data->spawner->shouldSpawnRegular(data->direction, deltaTime)) {
-            int lane = data->spawner->getLeastOccupiedLane(data->direction);
-            if (data->spawner->isLaneAvailable(data->direction, lane)) {
-                Vehicle* vehicle = new Vehicle("Light", data->direction, lane);
-                data->vehicles->push_back(vehicle);
-                data->spawner->incrementLaneCount(data->direction, lane);
-            }
+            addVehicle(data, "Light", data->spawner->getLeastOccupiedLane(data->direction, rng));
         }
     }
 
-    static void* directionThread(void* arg) {
+    // Tick tasks. The four directions spawn first so the signal
+    // controller sees this tick's arrivals, each direction's lanes then
+    // move on their own worker, violation checks follow their lanes, and
+    // collision detection looks at all four directions at once, then one
+    // publish task merges challans and snapshots the world:
+    //
+    //   spawn N --+              +--> lanes N --> violations N --+
+    //   ...       +--> signals --+    (same for W, S, E)         +--> collisions --> publish
+    //   spawn E --+
+    static void signalTask(void* arg) {
+        ScopedTimer timer(PROBE_SIGNALS);
+        Simulation* sim = (Simulation*)arg;
+        sim->trafficManager.update(sim->clock.step(), sim->directionVehicles);
+    }
+
+    static void spawnTask(void* arg) {
+        ScopedTimer timer(PROBE_SPAWN);
         ThreadData* data = (ThreadData*)arg;
-        sf::Clock threadClock;
-        
-        while(*(data->running) && *(data->simulationTime) < SIMTIME) {
-            float deltaTime = threadClock.restart().asSeconds();
-            
-            pthread_mutex_lock(data->mutex);
-            
-            spawnVehicles(data, deltaTime);
-            updateVehicles(data, deltaTime);
-            
-            pthread_mutex_unlock(data->mutex);
-            
-            sf::sleep(sf::milliseconds(16));
+        spawnVehicles(data, data->clock->step());
+    }
+
+    static void laneTask(void* arg) {
+        ScopedTimer timer(PROBE_LANES);
+        ThreadData* data = (ThreadData*)arg;
+        updateVehicles(data, data->clock->step());
+    }
+
+    static void violationTask(void* arg) {
+        ScopedTimer timer(PROBE_VIOLATIONS);
+        ThreadData* data = (ThreadData*)arg;
+        data->trafficManager->checkViolations(*data->vehicles, data->clock->step());
+    }
+
+    // After every violation check, both write vehicle flags. Events are
+    // only counted here; the totals are printed when the run ends.
+    static void collisionTask(void* arg) {
+        ScopedTimer timer(PROBE_COLLISIONS);
+        Simulation* sim = (Simulation*)arg;
+        sim->collisions.detect(sim->directionVehicles, sim->clock.tick());
+    }
+
+    static void publishTask(void* arg) {
+        ScopedTimer timer(PROBE_PUBLISH);
+        Simulation* sim = (Simulation*)arg;
+        sim->trafficManager.flushChallans();
+        const TrafficStats& stats = sim->trafficManager.stats;
+        for (int d = 0; d < 4; d++) {
+            sim->laneVehicles[d][0].set(stats.lane(d, 1));
+            sim->laneVehicles[d][1].set(stats.lane(d, 2));
+        }
+        sim->outboxDepth.set(sim->trafficManager.outbox.depth());
+        if (!sim->headless) {
+            sim->captureSnapshot(sim->snapshots.back());
+            sim->snapshots.publish();
+        }
+    }
+
+    void buildTickGraph() {
+        static const char* names[4][3] = {
+            {"spawn N", "lanes N", "violations N"},
+            {"spawn W", "lanes W", "violations W"},
+            {"spawn S", "lanes S", "violations S"},
+            {"spawn E", "lanes E", "violations E"}};
+        int signals = tickGraph.add("signals", signalTask, this);
+        int collisions = tickGraph.add("collisions", collisionTask, this);
+        int publish = tickGraph.add("publish", publishTask, this);
+        tickGraph.precede(collisions, publish);
+        for(int d = 0; d < 4; d++) {
+            int spawn = tickGraph.add(names[d][0], spawnTask, &threadData[d]);
+            int lanes = tickGraph.add(names[d][1], laneTask, &threadData[d]);
+            int violations = tickGraph.add(names[d][2], violationTask, &threadData[d]);
+            tickGraph.precede(spawn, signals);  // controllers see this tick's arrivals
+            tickGraph.precede(signals, lanes);
+            tickGraph.precede(lanes, violations);
+            tickGraph.precede(violations, collisions);
+        }
+    }
+
+    // One fixed step on the pool, returns when every task is done. The
+    // clock only moves between ticks, so every task of a tick sees the
+    // same tick and time.
+    void step() {
+        {
+            ScopedTimer timer(PROBE_TICK);
+            uint64_t start = monotonicNs();
+            scheduler.run(tickGraph);
+            tickTime.recordNs(monotonicNs() - start);
+        }
+        clock.advance();
+        spawner.setCurrentTime(clock.clockTime());
+        Instrumentation::pollDump();
+    }
+
+    // Registers this process's metrics in the shared registry, see
+    // headers/metrics.h
+    void enableMetrics() {
+        static const char* directions[4] = {"north", "west", "south", "east"};
+        MetricsRegistry& registry = MetricsRegistry::instance();
+        tickTime = registry.histogram("traffic_tick_seconds", "Wall time of one simulation tick");
+        for (int d = 0; d < 4; d++) {
+            for (int l = 0; l < 2; l++) {
+                char labels[48];
+                snprintf(labels, sizeof(labels), "direction=\"%s\",lane=\"%d\"", directions[d], l + 1);
+                laneVehicles[d][l] = registry.gauge("traffic_vehicles", "Vehicles on the road per lane", labels);
+            }
+        }
+        outboxDepth = registry.gauge("challan_outbox_depth", "Challan batches queued for the challan FIFO");
+    }
+
+    // Windowed runs: same fixed ticks, paced by the clock's compression
+    static void* tickThreadMain(void* arg) {
+        Simulation* sim = (Simulation*)arg;
+        Instrumentation::nameThread("tick");
+        sim->clock.startPacing();
+        while(sim->isRunning && sim->clock.elapsed() < sim->duration) {
+            sim->step();
+            ScopedTimer timer(PROBE_PACING);
+            sim->clock.pace();
         }
+        sim->isRunning = false;
         return NULL;
     }
 
+    void startThreads() {
+        pthread_create(&tickThread, NULL, tickThreadMain, this);
+        threadsStarted = true;
+    }
+
+    // Runs the same tick graph with no window. Unpaced unless the clock
+    // was given a compression. The calling thread drives the ticks.
+    // Returns simulated seconds per wall second.
+    float startHeadless(int startHour = 0) {
+        time_t now = time(nullptr);
+        struct tm* timeinfo = localtime(&now);
+        timeinfo->tm_hour = startHour;
+        timeinfo->tm_min = 0;
+        timeinfo->tm_sec = 0;
+        clock.setStartClock(mktime(timeinfo), CLOCK_SCALE);
+        spawner.setCurrentTime(clock.clockTime());
+
+        Instrumentation::nameThread("tick");
+        auto wallStart = std::chrono::steady_clock::now();
+
+        // first minute fills the lanes and pending queues to capacity,
+        // after that the tick should not allocate at all
+        const float WARMUP = 60.0f;
+        long warmAllocations = -1;
+        clock.startPacing();
+        while(clock.elapsed() < duration) {
+            step();
+            {
+                ScopedTimer timer(PROBE_PACING);
+                clock.pace();
+            }
+            if (warmAllocations < 0 && clock.elapsed() >= WARMUP) {
+                warmAllocations = heapAllocationCount.load();
+            }
+        }
+        long steadyAllocations = warmAllocations < 0 ? 0 : heapAllocationCount.load() - warmAllocations;
+
+        float wallSeconds = std::chrono::duration<float>(
+            std::chrono::steady_clock::now() - wallStart).count();
+        float ratio = wallSeconds > 0 ? clock.elapsed() / wallSeconds : 0;
+
+        std::cout << "Headless run finished\n"
+                  << "Ticks: " << clock.tick() << "\n"
+                  << "Simulated seconds: " << clock.elapsed() << "\n"
+                  << "Wall seconds: " << wallSeconds << "\n"
+                  << "Vehicles spawned: " << VehicleTable::numVehicles << "\n"
+                  << "Violations: " << trafficManager.violationCount << "\n"
+                  << "Collisions: " << collisions.totalEvents << " (" << collisions.pairsTested
+                  << " pairs tested, " << collisions.cellOverflows << " cell overflows)\n"
+                  << "Heap allocations after warmup: " << steadyAllocations << "\n";
+        for(int i = 0; i < 4; i++) {
+            std::cout << "Table " << i << ": spawned " << directionVehicles[i].acquired
+                      << ", despawned " << directionVehicles[i].released
+                      << ", peak " << directionVehicles[i].highWater << "/" << VehicleTable::CAPACITY
+                      << ", exhausted " << directionVehicles[i].exhausted << "\n";
+        }
+        std::cout << "Sim seconds / wall second: " << ratio << std::endl;
+        clock.printReport();
+        trafficManager.printSignalReport(directionVehicles, clock.elapsed());
+        scheduler.printStats();
+        Instrumentation::dump(stdout);
+        return ratio;
+    }
+
     void start() {
         initializeTime();
         sf::Texture texBack;
         texBack.loadFromFile("res/background.jpg");
         sf::Sprite background(texBack);        
-        pthread_attr_t attr;
-        pthread_attr_init(&attr);
-        pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_JOINABLE);
-        pthread_create(&trafficThread, &attr, trafficControlThread, this);
-        pthread_attr_destroy(&attr);
-        
-        for(int i = 0; i < 4; i++) {
-            pthread_create(&threads[i], NULL, directionThread, &threadData[i]);
-        }
+        vehicleSprite.setTexture(TextureCache::instance().atlas());
+        startThreads();
+        Instrumentation::nameThread("render");
         
         sf::Event e;
-        while(window.isOpen() && simulationTime < SIMTIME) {
-            float deltaTime = clock.restart().asSeconds();
-            simulationTime += deltaTime;
-            updateSimulationTime(deltaTime);
-                 
+        while(window.isOpen() && isRunning) {
+            ScopedTimer frame(PROBE_FRAME);
             while(window.pollEvent(e)) {
                 if(e.type == sf::Event::Closed) {
                     window.close();
@@ -355,35 +600,32 @@ public:
             window.clear(sf::Color::White);
             window.draw(background);
             
-            pthread_mutex_lock(&vehicleMutex);
-            for(const auto& pair : directionVehicles) {
-                for(const auto& vehicle : pair.second) {
-                    window.draw(vehicle->veh);
-                }
+            // latest published tick, the simulation keeps running meanwhile
+            const WorldSnapshot& snapshot = snapshots.latest();
+            for(int i = 0; i < snapshot.vehicleCount; i++) {
+                fillSprite(snapshot.vehicles[i], vehicleSprite);
+                window.draw(vehicleSprite);
             }
-            trafficManager.draw(window);
-            pthread_mutex_unlock(&vehicleMutex);
+            trafficManager.draw(window, snapshot);
             
+            showTime(snapshot.clock);
             window.draw(timeText);
             
             window.display();
+            trafficManager.renderStats();
         }
     }
 
     ~Simulation() {
         isRunning = false;
-        pthread_join(trafficThread, NULL);
-        for(int i = 0; i < 4; i++) {
-            pthread_join(threads[i], NULL);
-        }
-        
-        pthread_mutex_destroy(&vehicleMutex);
-        sem_destroy(&intersectionSemaphore);
-        
-        for(auto& pair : directionVehicles) {
-            for(auto vehicle : pair.second) {
-                delete vehicle;
-            }
+        if (threadsStarted) {
+            pthread_join(tickThread, NULL);
+            clock.printReport();
+            trafficManager.printSignalReport(directionVehicles, clock.elapsed());
+            printf("Collisions: %ld (%ld pairs tested, %ld cell overflows)\n", collisions.totalEvents,
+                   collisions.pairsTested, collisions.cellOverflows);
+            scheduler.printStats();
+            Instrumentation::dump(stdout);
         }
     }
 };
@@ -0,0 +1,70 @@
+#ifndef SNAPSHOT_H
+#define SNAPSHOT_H
+
+#include "vehicle.h"
+
+struct VehicleSnapshot {
+    float x, y;
+    unsigned char skin;
+    unsigned char direction;
+};
+
+// Everything the windows draw, copied out of the simulation once a tick
+struct WorldSnapshot {
+    static const int MAX_VEHICLES = VehicleTable::CAPACITY * 4;
+
+    VehicleSnapshot vehicles[MAX_VEHICLES];
+    int vehicleCount = 0;
+
+    int currentGreen = 0;
+    bool isYellow = false;
+
+    time_t clock = 0;  // mock time of day shown in the corner
+    long tick = 0;  // bumps on every publish
+};
+
+// Sets up a sprite for one snapshot vehicle, the only place sprites exist
+inline void fillSprite(const VehicleSnapshot& vehicle, sf::Sprite& sprite) {
+    const sf::IntRect& rect = TextureCache::instance().rect(vehicle.skin);
+    sprite.setTextureRect(rect);
+    sprite.setOrigin(rect.width / 2.0f, rect.height / 2.0f);
+    sprite.setPosition(vehicle.x, vehicle.y);
+    sprite.setRotation(SPAWN_POINTS[vehicle.direction].rotation);
+}
+
+// Triple buffer with one writer (the simulation) and one reader (the
+// render loop). The writer fills back() and publish() swaps it with the
+// middle buffer; latest() swaps the middle into front only if something
+// new was published. Neither side ever waits for the other.
+class SnapshotBuffer {
+private:
+    static const int FRESH = 4;  // set on middle when it holds unread data
+
+    WorldSnapshot buffers[3];
+    std::atomic<int> middle;
+    int backIndex;   // writer only
+    int frontIndex;  // reader only
+
+public:
+    SnapshotBuffer() : middle(1), backIndex(0), frontIndex(2) {}
+
+    WorldSnapshot& back() {
+        return buffers[backIndex];
+    }
+
+    void publish() {
+        buffers[backIndex].tick++;
+        long tick = buffers[backIndex].tick;
+        backIndex = middle.exchange(backIndex | FRESH, std::memory_order_acq_rel) & ~FRESH;
+        buffers[backIndex].tick = tick;
+    }
+
+    const WorldSnapshot& latest() {
+        if (middle.load(std::memory_order_acquire) & FRESH) {
+            frontIndex = middle.exchange(frontIndex, std::memory_order_acq_rel) & ~FRESH;
+        }
+        return buffers[frontIndex];
+    }
+};
+
+#endif
@@ -0,0 +1,305 @@
+#ifndef TASKSCHEDULER_H
+#define TASKSCHEDULER_H
+
+#include <atomic>
+#include "instrumentation.h"
+#include <pthread.h>
+#include <sched.h>
+#include <time.h>
+#include <unistd.h>
+#include <cstdio>
+
+typedef void (*TaskFn)(void* arg);
+
+// One unit of per tick work and the tasks that must wait for it
+struct TaskNode {
+    static const int MAX_SUCCESSORS = 32;
+
+    const char* name;
+    TaskFn fn;
+    void* arg;
+    int successors[MAX_SUCCESSORS];
+    int successorCount;
+    int dependencies;           // fixed when the graph is built
+    std::atomic<int> waiting;   // dependencies left in the current run
+};
+
+// Dependency graph built once and run every tick, so a tick allocates
+// nothing. Tasks are plain function pointers like the old thread entry
+// points, arg is whatever state they work on.
+class TaskGraph {
+public:
+    static const int MAX_TASKS = 1024;
+
+    TaskNode nodes[MAX_TASKS];
+    int count;
+
+    TaskGraph() : count(0) {}
+
+    // Returns the task's index, or -1 if the graph is full
+    int add(const char* name, TaskFn fn, void* arg) {
+        if (count == MAX_TASKS) return -1;
+        TaskNode& node = nodes[count];
+        node.name = name;
+        node.fn = fn;
+        node.arg = arg;
+        node.successorCount = 0;
+        node.dependencies = 0;
+        return count++;
+    }
+
+    // after does not start until before has finished, false if before
+    // already has MAX_SUCCESSORS
+    bool precede(int before, int after) {
+        TaskNode& node = nodes[before];
+        if (node.successorCount == TaskNode::MAX_SUCCESSORS) return false;
+        node.successors[node.successorCount++] = after;
+        nodes[after].dependencies++;
+        return true;
+    }
+};
+
+// Per worker queue of ready task indices. The owner pushes and pops at
+// the bottom (newest first, still warm in its cache), idle workers steal
+// from the top. Ticks only have a few dozen tasks, so a short lock per
+// operation is cheaper than it sounds and keeps this simple.
+class WorkDeque {
+private:
+    int items[TaskGraph::MAX_TASKS];
+    int top;
+    int bottom;
+    pthread_spinlock_t lock;
+
+public:
+    WorkDeque() : top(0), bottom(0) {
+        pthread_spin_init(&lock, PTHREAD_PROCESS_PRIVATE);
+    }
+
+    ~WorkDeque() {
+        pthread_spin_destroy(&lock);
+    }
+
+    void push(int task) {
+        pthread_spin_lock(&lock);
+        items[bottom % TaskGraph::MAX_TASKS] = task;
+        bottom++;
+        pthread_spin_unlock(&lock);
+    }
+
+    bool pop(int& task) {
+        pthread_spin_lock(&lock);
+        bool found = bottom > top;
+        if (found) {
+            task = items[--bottom % TaskGraph::MAX_TASKS];
+        }
+        if (top == bottom) {
+            top = bottom = 0;
+        }
+        pthread_spin_unlock(&lock);
+        return found;
+    }
+
+    bool steal(int& task) {
+        pthread_spin_lock(&lock);
+        bool found = bottom > top;
+        if (found) {
+            task = items[top++ % TaskGraph::MAX_TASKS];
+        }
+        if (top == bottom) {
+            top = bottom = 0;
+        }
+        pthread_spin_unlock(&lock);
+        return found;
+    }
+};
+
+// Work stealing pool that runs a TaskGraph to completion once per call.
+// The calling thread is worker 0 and helps until the graph is done;
+// the other workers sleep on a condition variable between ticks.
+class TaskScheduler {
+private:
+    struct alignas(64) Worker {
+        TaskScheduler* pool;
+        int index;
+        pthread_t thread;
+        WorkDeque deque;
+        unsigned victim;  // next deque to try stealing from
+
+        // stats, written only by this worker
+        long busyNs;
+        long tasks;
+        long steals;
+    };
+
+    Worker* workers;
+    int workerCount;
+    TaskGraph* graph;
+    std::atomic<int> remaining;  // tasks of the current run not finished
+    std::atomic<int> queued;     // tasks sitting in any deque
+    std::atomic<int> sleeping;
+    std::atomic<bool> running;
+    InstrumentedMutex sleepLock;
+    pthread_cond_t wake;
+    long startNs;
+
+    static long nowNs() {
+        timespec now;
+        clock_gettime(CLOCK_MONOTONIC, &now);
+        return now.tv_sec * 1000000000L + now.tv_nsec;
+    }
+
+    void push(Worker& worker, int task) {
+        worker.deque.push(task);
+        queued.fetch_add(1);
+        if (sleeping.load() > 0) {
+            sleepLock.lock();
+            pthread_cond_signal(&wake);
+            sleepLock.unlock();
+        }
+    }
+
+    bool take(Worker& worker, int& task) {
+        if (worker.deque.pop(task)) {
+            queued.fetch_sub(1);
+            return true;
+        }
+        for (int i = 1; i < workerCount; i++) {
+            Worker& victim = workers[(worker.victim + i) % workerCount];
+            if (&victim != &worker && victim.deque.steal(task)) {
+                worker.victim = victim.index;
+                worker.steals++;
+                queued.fetch_sub(1);
+                return true;
+            }
+        }
+        return false;
+    }
+
+    void execute(Worker& worker, int task) {
+        TaskNode& node = graph->nodes[task];
+        long start = nowNs();
+        node.fn(node.arg);
+        worker.busyNs += nowNs() - start;
+        worker.tasks++;
+
+        // newly ready successors go to this worker, others steal them
+        for (int i = 0; i < node.successorCount; i++) {
+            int next = node.successors[i];
+            if (graph->nodes[next].waiting.fetch_sub(1) == 1) {
+                push(worker, next);
+            }
+        }
+        remaining.fetch_sub(1);
+    }
+
+    static void* workerThread(void* arg) {
+        Worker& worker = *(Worker*)arg;
+        TaskScheduler& pool = *worker.pool;
+        char name[24];
+        snprintf(name, sizeof(name), "worker %d", worker.index);
+        Instrumentation::nameThread(name);
+        int task;
+        while (pool.running.load()) {
+            if (pool.take(worker, task)) {
+                pool.execute(worker, task);
+                continue;
+            }
+            // spin a little before sleeping, the next task is usually close
+            bool found = false;
+            for (int spin = 0; spin < 64 && !found; spin++) {
+                sched_yield();
+                found = pool.queued.load() > 0;
+            }
+            if (found) continue;
+
+            pool.sleepLock.lock();
+            pool.sleeping.fetch_add(1);
+            if (pool.queued.load() == 0 && pool.running.load()) {
+                pool.sleepLock.wait(&pool.wake);
+            }
+            pool.sleeping.fetch_sub(1);
+            pool.sleepLock.unlock();
+        }
+        return NULL;
+    }
+
+public:
+    // 0 workers means one per hardware thread
+    TaskScheduler(int count = 0) : graph(NULL), remaining(0), queued(0), sleeping(0), running(true) {
+        if (count <= 0) {
+            count = (int)sysconf(_SC_NPROCESSORS_ONLN);
+        }
+        workerCount = count < 1 ? 1 : count;
+        workers = new Worker[workerCount];
+        pthread_cond_init(&wake, NULL);
+        startNs = nowNs();
+
+        for (int i = 0; i < workerCount; i++) {
+            Worker& worker = workers[i];
+            worker.pool = this;
+            worker.index = i;
+            worker.victim = i + 1;
+            worker.busyNs = 0;
+            worker.tasks = 0;
+            worker.steals = 0;
+        }
+        for (int i = 1; i < workerCount; i++) {
+            pthread_create(&workers[i].thread, NULL, workerThread, &workers[i]);
+        }
+    }
+
+    ~TaskScheduler() {
+        sleepLock.lock();
+        running = false;
+        pthread_cond_broadcast(&wake);
+        sleepLock.unlock();
+        for (int i = 1; i < workerCount; i++) {
+            pthread_join(workers[i].thread, NULL);
+        }
+        pthread_cond_destroy(&wake);
+        delete[] workers;
+    }
+
+    int size() const { return workerCount; }
+
+    // Runs every task of the graph once, respecting precede() order, and
+    // returns when the last one finished. Only one thread may call this.
+    void run(TaskGraph& tasks) {
+        graph = &tasks;
+        for (int i = 0; i < tasks.count; i++) {
+            tasks.nodes[i].waiting.store(tasks.nodes[i].dependencies);
+        }
+        remaining.store(tasks.count);
+        Worker& self = workers[0];
+        for (int i = tasks.count - 1; i >= 0; i--) {
+            if (tasks.nodes[i].dependencies == 0) {
+                push(self, i);
+            }
+        }
+
+        int task;
+        while (remaining.load() > 0) {
+            if (take(self, task)) {
+                execute(self, task);
+            } else {
+                sched_yield();
+            }
+        }
+    }
+
+    // Share of wall time each worker spent inside tasks since startup
+    void printStats() const {
+        double wall = (double)(nowNs() - startNs);
+        long busy = 0;
+        printf("Task scheduler: %d workers\n", workerCount);
+        for (int i = 0; i < workerCount; i++) {
+            const Worker& worker = workers[i];
+            busy += worker.busyNs;
+            printf("  worker %2d: %9ld tasks, %7ld stolen, %5.1f%% busy\n", i, worker.tasks,
+                   worker.steals, wall > 0 ? 100.0 * worker.busyNs / wall : 0.0);
+        }
+        printf("  total: %.2f cores busy on average\n", wall > 0 ? busy / wall : 0.0);
+    }
+};
+
+#endif
@@ -0,0 +1,103 @@
+#ifndef TEXTURECACHE_H
+#define TEXTURECACHE_H
+
+#include "util.h"
+
+// Vehicle skins packed into the atlas
+enum VehicleSkin {
+    SKIN_CAR_0 = 0,
+    SKIN_CAR_1,
+    SKIN_CAR_2,
+    SKIN_CAR_3,
+    SKIN_TRUCK,
+    SKIN_AMBULANCE,
+    SKIN_COUNT
+};
+
+// Size of each skin's image in res/. Headless runs use these instead of
+// decoding the PNGs, so their results do not depend on res/ being there.
+static const int SKIN_SIZES[SKIN_COUNT][2] = {
+    {16, 30}, {13, 30}, {13, 30}, {14, 30},  // cars
+    {21, 55},                                 // truck
+    {16, 40}                                  // ambulance
+};
+
+// Process wide atlas of all vehicle images. Built once at startup so a
+// spawn only picks a skin id and a rect, no disk or gpu work per vehicle.
+class TextureCache {
+private:
+    sf::Texture atlasTexture;
+    sf::IntRect rects[SKIN_COUNT];
+    bool built;
+    bool uploaded;
+
+    TextureCache() : built(false), uploaded(false) {}
+
+    void useFixedSizes() {
+        int left = 0;
+        for (int i = 0; i < SKIN_COUNT; i++) {
+            rects[i] = sf::IntRect(left, 0, SKIN_SIZES[i][0], SKIN_SIZES[i][1]);
+            left += SKIN_SIZES[i][0];
+        }
+    }
+
+public:
+    static TextureCache& instance() {
+        static TextureCache cache;
+        return cache;
+    }
+
+    // Packs the images side by side into one strip. With upload = false
+    // (headless) the rects come from SKIN_SIZES and no file is read. If an
+    // image is missing the rects still fall back to SKIN_SIZES, so vehicles
+    // keep their size, and false is returned.
+    bool build(bool upload) {
+        if (built) return true;
+        if (!upload) {
+            useFixedSizes();
+            built = true;
+            return true;
+        }
+
+        const char* files[SKIN_COUNT] = {
+            "res/Car_0.png", "res/Car_1.png", "res/Car_2.png", "res/Car_3.png",
+            "res/truck.png", "res/Ambulance.png"
+        };
+        sf::Image images[SKIN_COUNT];
+        unsigned width = 0, height = 0;
+        for (int i = 0; i < SKIN_COUNT; i++) {
+            if (!images[i].loadFromFile(files[i])) {
+                useFixedSizes();
+                built = true;
+                return false;
+            }
+            sf::Vector2u size = images[i].getSize();
+            rects[i] = sf::IntRect(width, 0, size.x, size.y);
+            width += size.x;
+            height = std::max(height, size.y);
+        }
+
+        sf::Image atlas;
+        atlas.create(width, height, sf::Color(0, 0, 0, 0));
+        for (int i = 0; i < SKIN_COUNT; i++) {
+            atlas.copy(images[i], rects[i].left, 0);
+        }
+        uploaded = atlasTexture.loadFromImage(atlas);
+        built = true;
+        return true;
+    }
+
+    bool hasTexture() const {
+        return uploaded;
+    }
+
+    const sf::Texture& atlas() const {
+        return atlasTexture;
+    }
+
+    const sf::IntRect& rect(int skin) const {
+        return rects[skin];
+    }
+};
+
+#endif
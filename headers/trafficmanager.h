@@ -1,7 +1,9 @@
-#include "vehicle.h" 
+#include "snapshot.h"
+#include "challanoutbox.h"
+#include "signalcontrol.h"
+#include "trafficstats.h"
 #include <pthread.h>
 #include <map>
-#include <sstream>
 #include <unistd.h>
 #include <sys/types.h>
 #include <iostream>
@@ -10,12 +12,6 @@
 #include <string.h>
 
 
-struct ChallanMessage {
-    char vehicleId[50];
-    float speed;
-    bool isHeavy;
-};
-
 class TrafficManager {
 public:
     enum LightState {
@@ -25,17 +21,24 @@ public:
         EAST = 3
     };
     sf::CircleShape lights[4];
-    const float LIGHT_INTERVAL = 10.0f;
-    float timer;
+    float timer;  // time in the current green or yellow
     LightState currentGreen;
-    pthread_mutex_t* mutex;
+    LightState nextGreen;  // approach the yellow hands over to
     const float LIGHT_SIZE = 10.0f;
     const float YELLOW_DURATION = 2.0f;
     bool isYellow;
+    SignalController* controller;  // owned, fixed time unless replaced
+    bool headless;       // no windows and no challan processes
+    std::atomic<long> violationCount;  // violations seen, used for the headless report
+    ChallanOutbox outbox;  // hands challans to the challan process
+    ChallanBatch pendingBatch[4];  // episodes that ended this tick, per direction
+    ChallanBatch outgoing;         // the four merged for the outbox
+    TrafficStats stats;  // counts for the stats window, updated by events
 
     sf::RenderWindow statsWindow;
     sf::Font font;
     sf::Text statsText;
+    long shownVersion;  // stats version statsText was last formatted from
 
     void startChallanProcess() {
         pid_t pid = fork();
@@ -70,11 +73,20 @@ public:
         }
     }
 
-    TrafficManager(pthread_mutex_t* simulationMutex) 
-        : timer(0.0f), currentGreen(NORTH), mutex(simulationMutex), isYellow(false) {
-        startChallanProcess();
-        startUserPortalProcess();
-        startStripePaymentProcess();
+    TrafficManager(bool headless = false) 
+        : timer(0.0f), currentGreen(NORTH), nextGreen(NORTH), isYellow(false),
+          controller(new FixedTimeController()), headless(headless), violationCount(0),
+          shownVersion(-1) {
+        for (int i = 0; i < 4; i++) {
+            pendingBatch[i].count = 0;
+        }
+        outgoing.count = 0;
+        if (!headless) {
+            startChallanProcess();
+            startUserPortalProcess();
+            startStripePaymentProcess();
+            outbox.start();
+        }
         // Initialize lights
         for (int i = 0; i < 4; i++) {
             lights[i].setRadius(LIGHT_SIZE);
@@ -90,6 +102,10 @@ public:
         }
         lights[currentGreen].setFillColor(sf::Color::Green);
 
+        if (headless) {
+            return;
+        }
+
         // Stats window
         statsWindow.create(sf::VideoMode(400, 300), "SmartTraffix");
         statsWindow.setPosition({100, 200});
@@ -101,24 +117,66 @@ public:
         statsText.setFillColor(sf::Color::Black);
     }
 
-    void update(float deltaTime) {
+    void setController(SignalController* next) {
+        delete controller;
+        controller = next;
+    }
+
+    // Signals task: the controller picks when a green ends and which
+    // approach gets the next one, the yellow in between is fixed
+    void update(float deltaTime, const VehicleTable* vehicles) {
         timer += deltaTime;
 
-        if (isYellow && timer >= YELLOW_DURATION) {
-            lights[currentGreen].setFillColor(sf::Color::Red);
-            currentGreen = static_cast<LightState>((currentGreen + 1) % 4);
-            lights[currentGreen].setFillColor(sf::Color::Green);
-            isYellow = false;
-            timer = 0;
-        } else if (!isYellow && timer >= LIGHT_INTERVAL) {
-            lights[currentGreen].setFillColor(sf::Color::Yellow);
+        if (isYellow) {
+            if (timer >= YELLOW_DURATION) {
+                currentGreen = nextGreen;
+                isYellow = false;
+                timer = 0;
+                stats.onLightChange(currentGreen, false);
+            }
+            return;
+        }
+        ApproachState approaches[4];
+        for (int d = 0; d < 4; d++) {
+            approaches[d].waiting = vehicles[d].waiting;
+        }
+        int next = controller->decide(currentGreen, timer, approaches, 4);
+        if (next != currentGreen) {
+            nextGreen = static_cast<LightState>(next);
             isYellow = true;
             timer = 0;
+            stats.onLightChange(currentGreen, true);
+        }
+    }
+
+    // Throughput and delay per approach, for comparing controllers on the
+    // same seed
+    void printSignalReport(const VehicleTable* vehicles, double seconds) const {
+        static const char* names[4] = {"North", "West", "South", "East"};
+        long departures = 0;
+        double delay = 0;
+        printf("Signal control: %s\n", controller->name());
+        printf("approach  departures  per minute  avg delay s  waiting\n");
+        for (int d = 0; d < 4; d++) {
+            const VehicleTable& table = vehicles[d];
+            departures += table.departures;
+            delay += table.delaySeconds;
+            printf("%-8s  %10ld  %10.1f  %11.2f  %7d\n", names[d], table.departures,
+                   seconds > 0 ? table.departures * 60 / seconds : 0.0,
+                   table.departures ? table.delaySeconds / table.departures : 0.0, table.waiting);
         }
+        printf("total     %10ld  %10.1f  %11.2f\n", departures,
+               seconds > 0 ? departures * 60 / seconds : 0.0, departures ? delay / departures : 0.0);
     }
 
-    void draw(sf::RenderWindow& window) {
+    // Light colours come from the snapshot, so drawing needs no lock
+    void draw(sf::RenderWindow& window, const WorldSnapshot& snapshot) {
         for (int i = 0; i < 4; i++) {
+            sf::Color color = sf::Color::Red;
+            if (i == snapshot.currentGreen) {
+                color = snapshot.isYellow ? sf::Color::Yellow : sf::Color::Green;
+            }
+            lights[i].setFillColor(color);
             window.draw(lights[i]);
         }
     }
@@ -127,112 +185,135 @@ public:
         return direction == currentGreen && !isYellow;
     }
 
-    void updateStats(const std::map<int, std::vector<Vehicle*>>& vehicles) {
-        int counts[4] = {0}; // North, East, South, West
-        int lightCount = 0, heavyCount = 0, emergencyCount = 0, challanCount = 0;
-
-        for (const auto& directionVehicles : vehicles) {
-            int direction = directionVehicles.first;
-            const auto& vehicleList = directionVehicles.second;
+    // Copies the lights into the snapshot, runs after every lane task
+    void captureLights(WorldSnapshot& snapshot) const {
+        snapshot.currentGreen = currentGreen;
+        snapshot.isYellow = isYellow;
+    }
 
-            counts[direction] += vehicleList.size();
+    // Runs on the render thread. Counts come straight from the stats, no
+    // lock and no table scan; the text is only rebuilt when one changed.
+    void renderStats() {
+        ScopedTimer timer(PROBE_STATS_FRAME);
+        long version = stats.version();
+        if (version != shownVersion) {
+            shownVersion = version;
+            char text[512];
+            snprintf(text, sizeof(text),
+                     "Vehicles Count:\n"
+                     "North: %d (lanes %d/%d)\n"
+                     "West: %d (lanes %d/%d)\n"
+                     "South: %d (lanes %d/%d)\n"
+                     "East: %d (lanes %d/%d)\n\n"
+                     "Light Vehicles: %d\n"
+                     "Heavy Vehicles: %d\n"
+                     "Emergency Vehicles: %d\n"
+                     "Active Challans: %d\n"
+                     "Throughput: %ld",
+                     stats.active(NORTH), stats.lane(NORTH, 1), stats.lane(NORTH, 2),
+                     stats.active(WEST), stats.lane(WEST, 1), stats.lane(WEST, 2),
+                     stats.active(SOUTH), stats.lane(SOUTH, 1), stats.lane(SOUTH, 2),
+                     stats.active(EAST), stats.lane(EAST, 1), stats.lane(EAST, 2),
+                     stats.byType(VEHICLE_LIGHT), stats.byType(VEHICLE_HEAVY),
+                     stats.byType(VEHICLE_EMERGENCY), stats.challans(), stats.throughput());
+            statsText.setString(text);
+        }
 
-            for (const auto& vehicle : vehicleList) {
-                if (vehicle->hasChallan) {
-                    challanCount++;
-                }
-                if (vehicle->isHeavy) {
-                    heavyCount++;
-                } else if (vehicle->isEmergency) {
-                    emergencyCount++;
-                } else {
-                    lightCount++;
-                }
+        sf::Event event;
+        while (statsWindow.pollEvent(event)) {
+            if (event.type == sf::Event::Closed) {
+                statsWindow.close();
             }
         }
-
-        std::stringstream ss;
-        ss << "Vehicles Count:\n"
-           << "North: " << counts[0] << "\n"
-           << "East: " << counts[1] << "\n"
-           << "South: " << counts[2] << "\n"
-           << "West: " << counts[3] << "\n\n"
-           << "Light Vehicles: " << lightCount << "\n"
-           << "Heavy Vehicles: " << heavyCount << "\n"
-           << "Emergency Vehicles: " << emergencyCount << "\n"
-           << "Active Challans: " << challanCount;
-
-        statsText.setString(ss.str());
-    }
-
-    void renderStats() {
         statsWindow.clear(sf::Color::White);
         statsWindow.draw(statsText);
         statsWindow.display();
     }
 
-    void run() {
-        while (statsWindow.isOpen()) {
-            sf::Event event;
-            while (statsWindow.pollEvent(event)) {
-                if (event.type == sf::Event::Closed) {
-                    statsWindow.close();
-                }
-            }
-            renderStats();
-        }
+    static bool isOverLimit(const VehicleTable& table, int slot) {
+        float speed = table.currentSpeed[slot];
+        return (table.isHeavy(slot) && speed > 40) || 
+               (!table.isEmergency(slot) && speed > 60);
     }
 
-    void updateAndRender(const std::map<int, std::vector<Vehicle*>>& vehicles) {
-        updateStats(vehicles);
-        renderStats();
-
-        for (const auto& directionVehicles : vehicles) {
-            for (const auto& vehicle : directionVehicles.second) {
-                if ((vehicle->isHeavy && vehicle->currentSpeed > 40) || 
-                    (!vehicle->isEmergency && vehicle->currentSpeed > 60)) {
-                    vehicle->hasChallan = true;
-                    issueChallan(vehicle->numberPlate, vehicle->currentSpeed, vehicle->isHeavy);
-                }
+    // Edge triggered speed checks for one direction table, directions run
+    // as separate tasks. A violation starts when a vehicle goes over the
+    // limit, its peak speed and time over the limit are tracked while it
+    // stays there, and one challan record goes out when it ends. Only a
+    // vehicle's first episode gets a challan.
+    void checkViolations(VehicleTable& table, float deltaTime) {
+        for (int i = 0; i < VehicleTable::CAPACITY; i++) {
+            if (!table.alive(i)) continue;
+            bool over = isOverLimit(table, i);
+            bool violating = table.flags[i] & FLAG_VIOLATION;
 
-                // accident logic probelamtic
-                // for (const auto& otherDirectionVehicles : vehicles) {
-                //     for (const auto& otherVehicle : otherDirectionVehicles.second) {
-                //         if (vehicle != otherVehicle && 
-                //             vehicle->getBoundingBox().intersects(otherVehicle->getBoundingBox())) {
-                //             vehicle->hasCollision = true;
-                //         }
-                //     }
-                // }
-
-                // if (vehicle->hasViolation ) { //|| vehicle->hasCollision) {
-                    
-                    
-                //     vehicle->hasViolation = false;
-                //     vehicle->hasCollision = false;
-                // }
+            if (over && !violating) {
+                if (table.flags[i] & FLAG_CHALLAN) continue;
+                table.flags[i] |= FLAG_VIOLATION | FLAG_CHALLAN;
+                table.peakSpeed[i] = table.currentSpeed[i];
+                table.overLimitTime[i] = 0;
+                violationCount++;
+                stats.onViolation(table.direction);
+            } else if (over) {
+                table.peakSpeed[i] = std::max(table.peakSpeed[i], table.currentSpeed[i]);
+                table.overLimitTime[i] += deltaTime;
+            } else if (violating) {
+                closeViolation(table, i);
             }
         }
     }
 
-    void issueChallan(const std::string& vehicleId, float speed, bool isHeavy) {
-        const char* fifoPath = "/tmp/challan_fifo";
+    // Ends a vehicle's violation episode and adds it to its direction's
+    // batch for this tick. Also called on despawn so episodes that leave
+    // the screen are not lost. Each vehicle closes at most one episode a
+    // tick, so a direction's batch cannot fill up before flushChallans.
+    void closeViolation(VehicleTable& table, int slot) {
+        static_assert(VehicleTable::CAPACITY <= ChallanBatch::MAX_RECORDS,
+                      "one tick of one direction must fit in a batch");
+        if (!(table.flags[slot] & FLAG_VIOLATION)) return;
+        table.flags[slot] &= ~FLAG_VIOLATION;
+        if (headless) return;
 
-        mkfifo(fifoPath, 0666);
+        ChallanBatch& batch = pendingBatch[table.direction];
+        ChallanRecord& record = batch.records[batch.count++];
+        memset(&record, 0, sizeof(record));  // padding goes on the wire too
+        strncpy(record.vehicleId, table.numberPlate[slot], sizeof(record.vehicleId) - 1);
+        record.vehicleId[sizeof(record.vehicleId) - 1] = '\0';
+        record.detectedNs = monotonicNs();
+        record.peakSpeed = table.peakSpeed[slot];
+        record.overLimitSeconds = table.overLimitTime[slot];
+        record.isHeavy = table.isHeavy(slot);
+    }
 
-        int fd = open(fifoPath, O_WRONLY);
-        if (fd == -1) {
-            std::cerr << "Failed to open FIFO for writing." << std::endl;
-            return;
+    // Merges the directions' batches and hands them to the outbox writer.
+    // Runs once a tick after every direction is done, so the outbox keeps
+    // a single producer. Never blocks on IPC.
+    void flushChallans() {
+        for (int d = 0; d < 4; d++) {
+            ChallanBatch& batch = pendingBatch[d];
+            for (uint32_t i = 0; i < batch.count; i++) {
+                if (outgoing.count == ChallanBatch::MAX_RECORDS) {
+                    outbox.enqueue(outgoing);
+                    outgoing.count = 0;
+                }
+                outgoing.records[outgoing.count++] = batch.records[i];
+            }
+            batch.count = 0;
         }
+        if (outgoing.count == 0) return;
+        outbox.enqueue(outgoing);
+        outgoing.count = 0;
+    }
 
-        ChallanMessage msg;
-        strncpy(msg.vehicleId, vehicleId.c_str(), sizeof(msg.vehicleId) - 1);
-        msg.vehicleId[sizeof(msg.vehicleId) - 1] = '\0';
-        msg.speed = speed;
-        msg.isHeavy = isHeavy;
-
-        write(fd, &msg, sizeof(msg));
-        close(fd);
+    ~TrafficManager() {
+        delete controller;
+        if (!headless) {
+            // the writer may be stuck on a missing reader, so the last
+            // batches must not wait for room in the queue
+            outbox.setPolicy(OUTBOX_SPILL);
+            flushChallans();
+            outbox.stop();
+            outbox.printStats();
+        }
     }
 };
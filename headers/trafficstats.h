@@ -0,0 +1,127 @@
+#ifndef TRAFFICSTATS_H
+#define TRAFFICSTATS_H
+
+#include "vehicle.h"
+#include <atomic>
+
+// One direction's counters. Only that direction's tasks write them (its
+// spawn, lanes and violations tasks never run at the same time), so a
+// write is a plain load and store; any thread may read.
+struct DirectionStats {
+    std::atomic<int> active{0};
+    std::atomic<int> byType[3] = {};  // indexed by VehicleType
+    std::atomic<int> byLane[2] = {};  // lanes[0] is lane 1
+    std::atomic<int> challans{0};     // alive vehicles holding a challan
+    std::atomic<long> spawned{0};
+    std::atomic<long> despawned{0};
+    std::atomic<long> departures{0};  // crossed the stop line
+    std::atomic<long> violations{0};
+    std::atomic<long> version{0};     // bumps on every event
+};
+
+// Traffic counts kept current by events (spawn, despawn, departures,
+// violation, light change) instead of rescanning the vehicle tables.
+// Every read is a handful of relaxed loads and takes no lock, so the
+// stats window can poll it every frame and only reformat when version()
+// moves.
+class TrafficStats {
+private:
+    DirectionStats directions[4];
+    std::atomic<int> green{0};
+    std::atomic<bool> yellow{false};
+    std::atomic<long> lightChanges{0};
+
+    template <typename T>
+    static void add(std::atomic<T>& counter, T by) {
+        counter.store(counter.load(std::memory_order_relaxed) + by, std::memory_order_relaxed);
+    }
+
+    template <typename T>
+    static T read(const std::atomic<T>& counter) {
+        return counter.load(std::memory_order_relaxed);
+    }
+
+    static void changed(DirectionStats& stats) {
+        add(stats.version, 1L);
+    }
+
+public:
+    // Spawn task of the direction
+    void onSpawn(int direction, int lane, int type) {
+        DirectionStats& stats = directions[direction];
+        add(stats.active, 1);
+        add(stats.byType[type], 1);
+        add(stats.byLane[lane - 1], 1);
+        add(stats.spawned, 1L);
+        changed(stats);
+    }
+
+    // Lanes task of the direction, as a vehicle leaves the screen
+    void onDespawn(int direction, int lane, int type, bool challan) {
+        DirectionStats& stats = directions[direction];
+        add(stats.active, -1);
+        add(stats.byType[type], -1);
+        add(stats.byLane[lane - 1], -1);
+        if (challan) add(stats.challans, -1);
+        add(stats.despawned, 1L);
+        changed(stats);
+    }
+
+    // Lanes task, vehicles that crossed the stop line this tick
+    void onDepartures(int direction, long count) {
+        if (count == 0) return;
+        DirectionStats& stats = directions[direction];
+        add(stats.departures, count);
+        changed(stats);
+    }
+
+    // Violations task, when a vehicle gets its challan
+    void onViolation(int direction) {
+        DirectionStats& stats = directions[direction];
+        add(stats.challans, 1);
+        add(stats.violations, 1L);
+        changed(stats);
+    }
+
+    // Signals task, both when a yellow starts and when it ends
+    void onLightChange(int currentGreen, bool isYellow) {
+        green.store(currentGreen, std::memory_order_relaxed);
+        yellow.store(isYellow, std::memory_order_relaxed);
+        add(lightChanges, 1L);
+    }
+
+    const DirectionStats& direction(int d) const { return directions[d]; }
+
+    int active(int d) const { return read(directions[d].active); }
+    int lane(int d, int lane) const { return read(directions[d].byLane[lane - 1]); }
+
+    int byType(int type) const {
+        int total = 0;
+        for (const DirectionStats& stats : directions) total += read(stats.byType[type]);
+        return total;
+    }
+
+    int challans() const {
+        int total = 0;
+        for (const DirectionStats& stats : directions) total += read(stats.challans);
+        return total;
+    }
+
+    long throughput() const {
+        long total = 0;
+        for (const DirectionStats& stats : directions) total += read(stats.departures);
+        return total;
+    }
+
+    int currentGreen() const { return read(green); }
+    bool isYellow() const { return read(yellow); }
+
+    // Changes whenever any counter does
+    long version() const {
+        long total = read(lightChanges);
+        for (const DirectionStats& stats : directions) total += read(stats.version);
+        return total;
+    }
+};
+
+#endif
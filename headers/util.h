@@ -5,6 +5,7 @@
 #include <queue>
 #include <memory>
 #include <ctime>
+#include <atomic>
 
 // Constants for road and lane dimensions
 #define LANE_WIDTH 26
@@ -15,6 +16,11 @@
 #define CENTER_Y (HEIGHT / 2)  // 448
 #define SIMTIME 300 // Simulation time (5 mins)
 #define MAX_VEHICLES_PER_LANE 10
+#define SIM_STEP (1.0f / 60.0f) // Fixed tick for every run (~16ms)
+#define CLOCK_SCALE 60.0f // Clock seconds per simulated second (1 sec = 1 min)
+#define METRICS_PORT 9464 // localhost HTTP metrics endpoint of the simulator
+#define METRICS_FILE "metrics.prom" // metrics snapshot, rewritten every interval
+#define METRICS_INTERVAL_MS 5000
 
 // Time constants (in seconds since midnight)
 const int TIME_7AM = 7 * 3600;
@@ -22,6 +28,10 @@ const int TIME_930AM = 9 * 3600 + 30 * 60;
 const int TIME_430PM = 16 * 3600 + 30 * 60;
 const int TIME_830PM = 20 * 3600 + 30 * 60;
 
+// operator new calls seen by binaries that install a counting allocator
+// (headless.cpp does). Lets a run show the steady state tick never allocates.
+inline std::atomic<long> heapAllocationCount{0};
+
 // Intersection box dimensions
 struct intersectionBox{
     const sf::Vector2f  dim = {122,113}; // Width and height
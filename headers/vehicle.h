@@ -1,154 +1,386 @@
 #ifndef VEHICLE_H
 #define VEHICLE_H
 
-#include "util.h"
+#include "texturecache.h"
+#include "rng.h"
+#include <cstdio>
 
-class Vehicle {
+enum VehicleType : unsigned char {
+    VEHICLE_LIGHT = 0,
+    VEHICLE_HEAVY,
+    VEHICLE_EMERGENCY
+};
+
+enum VehicleFlag : unsigned char {
+    FLAG_ALIVE = 1,
+    FLAG_CHALLAN = 2,
+    FLAG_VIOLATION = 4,   // speed limit violation
+    FLAG_COLLISION = 8,
+    FLAG_PASSED = 16,     // front crossed the stop line
+    FLAG_STOPPED = 32     // standing still before the stop line
+};
+
+const float STOPPED_SPEED = 5.0f;  // below this a vehicle counts as stopped
+
+// Slots of one lane in road order, front is the vehicle furthest along.
+// Ring buffer, so push at the back and pop at the front are O(1).
+class LaneQueue {
 public:
-    sf::Texture tex;
-    sf::Sprite veh;
-    short maxSpeed;
-    static int numVehicles;
-    std::string numberPlate;
-    int direction;  // Direction of the vehicle
-    float currentSpeed;
-    bool isEmergency;
-    bool isHeavy;
-    float speedUpdateTimer;
-    int lane;  // Lane number
-    bool hasChallan;
-    bool hasViolation; // Flag for speed limit violation
-    bool hasCollision; // Flag for collision
-
-    Vehicle(std::string type, int direction, int lane) {
-        // Initialize vehicle properties
-        this->lane = lane;
-        speedUpdateTimer = 0;
-        isHeavy = false;
-        isEmergency = false;
-        hasChallan = false;
-        //hasViolation = false; 
-        hasCollision = false; 
-        
+    static const int CAPACITY = MAX_VEHICLES_PER_LANE * 2;
+
+private:
+    int slots[CAPACITY];
+    int head;
+    int count;
+
+public:
+    LaneQueue() : head(0), count(0) {}
+
+    int size() const { return count; }
+    bool empty() const { return count == 0; }
+
+    // k = 0 is the front
+    int at(int k) const { return slots[(head + k) % CAPACITY]; }
+    int front() const { return slots[head]; }
+    int back() const { return at(count - 1); }
+
+    bool push_back(int slot) {
+        if (count == CAPACITY) return false;
+        slots[(head + count) % CAPACITY] = slot;
+        count++;
+        return true;
+    }
+
+    void pop_front() {
+        head = (head + 1) % CAPACITY;
+        count--;
+    }
+
+    // Slow path for a vehicle leaving from the middle of the lane
+    void remove(int slot) {
+        int k = 0;
+        while (k < count && at(k) != slot) k++;
+        if (k == count) return;
+        for (; k < count - 1; k++) {
+            slots[(head + k) % CAPACITY] = at(k + 1);
+        }
+        count--;
+    }
+};
+
+// Vehicles of one direction stored as a structure of arrays. The per tick
+// update only touches the hot float/byte arrays; sprites are built from a
+// row at draw time. Rows are fixed slots recycled through a free list, so
+// spawn/despawn never allocate and a vehicle keeps its slot for life.
+class VehicleTable {
+public:
+    static const int CAPACITY = MAX_VEHICLES_PER_LANE * 2;  // two lanes
+    static std::atomic<int> numVehicles;  // spawned over the whole run
+
+    int direction;
+
+    // hot data, read/written every tick
+    float posX[CAPACITY];
+    float posY[CAPACITY];
+    float currentSpeed[CAPACITY];
+    float maxSpeed[CAPACITY];
+    float desiredSpeed[CAPACITY];  // IDM free road speed, above the limit for speeders
+    float speedUpdateTimer[CAPACITY];
+    float length[CAPACITY];  // sprite extent along the road
+    unsigned char lane[CAPACITY];  // 1 or 2
+    unsigned char type[CAPACITY];
+    unsigned char flags[CAPACITY];
+    int leader[CAPACITY];  // slot ahead in the same lane, -1 at the front
+    float peakSpeed[CAPACITY];      // while FLAG_VIOLATION is set
+    float overLimitTime[CAPACITY];  // seconds over the limit this episode
+
+    LaneQueue lanes[2];  // road order per lane, lanes[0] is lane 1
+
+    // cold data, only for drawing and challans
+    unsigned char skin[CAPACITY];
+    char numberPlate[CAPACITY][24];
+    uint32_t id[CAPACITY];  // unique in the run, keys the vehicle's random draws
+
+    // approach state for signal control and the delay report, kept current
+    // by spawn(), release() and the lane update instead of rescanning the table
+    int waiting;          // alive and not past the stop line
+    int stoppedCount;     // waiting and standing still, drives delaySeconds
+    int passedFront[2];   // per lane, vehicles at the front already past the line
+    long departures;      // crossed the stop line
+    double delaySeconds;  // vehicle seconds spent stopped before the line
+
+    long acquired;   // successful spawns
+    long released;   // despawns
+    long exhausted;  // spawns that found no free slot
+    int highWater;   // most rows in use at once
+
+private:
+    int freeSlots[CAPACITY];  // stack of free slots
+    int freeCount;
+
+public:
+    VehicleTable() : direction(0), waiting(0), stoppedCount(0), passedFront{0, 0},
+                     departures(0), delaySeconds(0), acquired(0), released(0),
+                     exhausted(0), highWater(0), freeCount(CAPACITY) {
+        // hand out low slots first
+        for (int i = 0; i < CAPACITY; i++) {
+            freeSlots[i] = CAPACITY - 1 - i;
+            flags[i] = 0;
+        }
+    }
+
+    bool alive(int slot) const {
+        return flags[slot] & FLAG_ALIVE;
+    }
+
+    bool isHeavy(int slot) const {
+        return type[slot] == VEHICLE_HEAVY;
+    }
+
+    bool isEmergency(int slot) const {
+        return type[slot] == VEHICLE_EMERGENCY;
+    }
+
+    int size() const {
+        return CAPACITY - freeCount;
+    }
+
+    // Distance a vehicle has covered along its road, grows in the
+    // direction of travel whatever the heading is
+    float along(int slot) const {
+        switch(direction) {
+            case 0: return posY[slot];           // NORTH, moving down
+            case 1: return posX[slot];           // WEST, moving right
+            case 2: return HEIGHT - posY[slot];  // SOUTH, moving up
+            default: return WIDTH - posX[slot];  // EAST, moving left
+        }
+    }
+
+    void setAlong(int slot, float distance) {
+        switch(direction) {
+            case 0: posY[slot] = distance; break;
+            case 1: posX[slot] = distance; break;
+            case 2: posY[slot] = HEIGHT - distance; break;
+            default: posX[slot] = WIDTH - distance; break;
+        }
+    }
+
+    // along() value where the road enters the intersection box
+    float stopLine() const {
+        intersectionBox box;
+        switch(direction) {
+            case 0: return box.top.y;
+            case 1: return box.top.x;
+            case 2: return HEIGHT - (box.top.y + box.dim.y);
+            default: return WIDTH - (box.top.x + box.dim.x);
+        }
+    }
+
+    // Last vehicle that entered a lane, -1 if the lane is empty
+    int tail(int laneNumber) const {
+        const LaneQueue& queue = lanes[laneNumber - 1];
+        return queue.empty() ? -1 : queue.back();
+    }
+
+    // Fills a free row for a new vehicle at the spawn point of this
+    // direction. Returns the slot, or -1 when the table is full.
+    // Ids count per direction, so they do not depend on which direction's
+    // task reached the shared counter first.
+    int spawn(const std::string& typeName, int laneNumber, uint32_t tick) {
+        LaneQueue& queue = lanes[laneNumber - 1];
+        if (freeCount == 0 || queue.size() == LaneQueue::CAPACITY) {
+            exhausted++;
+            return -1;
+        }
+        int slot = freeSlots[--freeCount];
+        id[slot] = acquired * 4 + direction;
+        acquired++;
+        numVehicles.fetch_add(1, std::memory_order_relaxed);
+        RandomStream rng(RNG_VEHICLE, id[slot], tick);
+        highWater = std::max(highWater, size());
+
+        lane[slot] = laneNumber;
+        speedUpdateTimer[slot] = 0;
+        flags[slot] = FLAG_ALIVE;
+        waiting++;
+
         // Setup vehicle based on its type
-        if(type == "Light") {
-            std::string car ="res/Car_" + std::to_string(rand() % 4) + ".png";
-            tex.loadFromFile(car);
-            maxSpeed = 60;
-            currentSpeed = 40 + (rand() % 21);
-        }
-        else if(type == "Heavy") {
-            tex.loadFromFile("res/truck.png");
-            maxSpeed = 40;
-            isHeavy = true;
-            currentSpeed = 20 + (rand() % 21);
+        if(typeName == "Light") {
+            type[slot] = VEHICLE_LIGHT;
+            skin[slot] = SKIN_CAR_0 + rng.below(4);
+            maxSpeed[slot] = 60;
+            currentSpeed[slot] = 40 + rng.below(21);
+        }
+        else if(typeName == "Heavy") {
+            type[slot] = VEHICLE_HEAVY;
+            skin[slot] = SKIN_TRUCK;
+            maxSpeed[slot] = 40;
+            currentSpeed[slot] = 20 + rng.below(21);
         }
         else {
-            tex.loadFromFile("res/Ambulance.png");
-            maxSpeed = 80;
-            isEmergency = true;
-            currentSpeed = 60 + (rand() % 21);
+            type[slot] = VEHICLE_EMERGENCY;
+            skin[slot] = SKIN_AMBULANCE;
+            maxSpeed[slot] = 80;
+            currentSpeed[slot] = 60 + rng.below(21);
         }
-        
-        
-        veh.setTexture(tex);
-        veh.setOrigin(veh.getLocalBounds().width/2, veh.getLocalBounds().height/2);
-        this->direction = direction;
-        numberPlate = type + std::to_string(numVehicles++);
-        
-        // ehicle position based on direction
-        sf::Vector2f pos(SPAWN_POINTS[direction].x, SPAWN_POINTS[direction].y);
-        float laneOffset = (lane == 1) ? 
+        // 5% of drivers want to go 20% over the limit
+        desiredSpeed[slot] = maxSpeed[slot] * ((rng.below(100) < 5) ? 1.2f : 1.0f);
+        // images are drawn nose up, so the height is the length on the road
+        length[slot] = TextureCache::instance().rect(skin[slot]).height;
+        snprintf(numberPlate[slot], sizeof(numberPlate[slot]), "%s%u",
+                 typeName.c_str(), id[slot]);
+
+        // vehicle position based on direction
+        posX[slot] = SPAWN_POINTS[direction].x;
+        posY[slot] = SPAWN_POINTS[direction].y;
+        float laneOffset = (laneNumber == 1) ? 
             SPAWN_POINTS[direction].lanes.lane1_offset : 
             SPAWN_POINTS[direction].lanes.lane2_offset;
 
         switch(direction) {
             case 0: // North
-                pos.x += laneOffset;
-                break;
-            case 1: // West
-                pos.y += laneOffset;
-                break;
             case 2: // South
-                pos.x += laneOffset;
+                posX[slot] += laneOffset;
                 break;
+            case 1: // West
             case 3: // East
-                pos.y += laneOffset;
+                posY[slot] += laneOffset;
                 break;
         }
-        
-        veh.setPosition(pos);
-        veh.setRotation(SPAWN_POINTS[direction].rotation);
+
+        // joins the back of its lane, behind the previous tail
+        leader[slot] = queue.empty() ? -1 : queue.back();
+        queue.push_back(slot);
+        return slot;
     }
 
-    //  box of the vehicle for collison detection
-    sf::FloatRect getBoundingBox() const {
-        return veh.getGlobalBounds();
-    }
-
-    private:
-        bool isAtIntersection() const {
-            intersectionBox box;
-            sf::Vector2f pos = veh.getPosition();
-            const float BUFFER = 20.0f;  // Buffer zone before intersection
-            
-            switch(direction) {
-                case 0: // NORTH
-                    if (pos.y > box.top.y ) return false;
-                    return pos.y > box.top.y - BUFFER && pos.y < box.top.y + box.dim.y;
-                case 1: // WEST
-                    if (pos.x > box.top.x) return false;
-                    return pos.x > box.top.x - BUFFER && pos.x < box.top.x + box.dim.x;
-                case 2: // SOUTH
-                    if (pos.y < box.top.y + box.dim.y ) return false;
-                    return pos.y < box.top.y + box.dim.y + BUFFER && pos.y > box.top.y;
-                case 3: // EAST
-                    if (pos.x < box.top.x + box.dim.x) return false;
-                    return pos.x < box.top.x + box.dim.x + BUFFER && pos.x > box.top.x;
-            }
-            return false;
-        }
-
-    public:
-        void update(float deltaTime, bool isGreenLight) {
-            // Update speed every 5 seconds 
-            speedUpdateTimer += deltaTime;
-            if(speedUpdateTimer >= 5.0f) {
-                speedUpdateTimer = 0;
-                if (!isAtIntersection() || isGreenLight || isEmergency) {
-                    float newSpeed = currentSpeed + 5.0f;
-                    if (rand() % 100 < 5) {
-                        currentSpeed = std::min(newSpeed * 1.2f, (float)maxSpeed * 1.2f); // 20% increase
-                    } else {
-                        currentSpeed = std::min(newSpeed, (float)maxSpeed);
-                    }
+    void release(int slot) {
+        if (!alive(slot)) return;
+        LaneQueue& queue = lanes[lane[slot] - 1];
+        if (flags[slot] & FLAG_PASSED) {
+            passedFront[lane[slot] - 1]--;
+        } else {
+            waiting--;
+            if (flags[slot] & FLAG_STOPPED) stoppedCount--;
+        }
+        if (queue.front() == slot) {
+            queue.pop_front();
+            if (!queue.empty()) leader[queue.front()] = -1;
+        } else {
+            // follower now trails whoever was ahead of this one
+            for (int k = 1; k < queue.size(); k++) {
+                if (queue.at(k - 1) == slot) {
+                    leader[queue.at(k)] = leader[slot];
+                    break;
                 }
             }
+            queue.remove(slot);
+        }
+        flags[slot] = 0;
+        freeSlots[freeCount++] = slot;
+        released++;
+    }
 
-            // Stop at red light unless emergency vehicle
-            if (isAtIntersection() && !isGreenLight && !isEmergency) {
-                currentSpeed = 0;
-                return;
-            }
+    // Called after a vehicle's speed changed this tick
+    void trackStopped(int slot) {
+        bool stopped = !(flags[slot] & FLAG_PASSED) && currentSpeed[slot] < STOPPED_SPEED;
+        if (stopped != bool(flags[slot] & FLAG_STOPPED)) {
+            flags[slot] ^= FLAG_STOPPED;
+            stoppedCount += stopped ? 1 : -1;
+        }
+    }
 
-            // Move vehicle 
-            float movement = currentSpeed * deltaTime;
-            switch(direction) {
-                case 0: // NORTH
-                    veh.move(0, movement);  // Move down
-                    break;
-                case 1: // WEST
-                    veh.move(movement, 0);  // Move right
-                    break;
-                case 2: // SOUTH
-                    veh.move(0, -movement); // Move up
-                    break;
-                case 3: // EAST
-                    veh.move(-movement, 0); // Move left
-                    break;
+    // Marks vehicles that crossed the stop line since the last call.
+    // Passed vehicles are always at the front of their lane, so only the
+    // first one not yet passed needs checking.
+    void trackPassed(int laneIndex) {
+        const LaneQueue& queue = lanes[laneIndex];
+        float line = stopLine();
+        while (passedFront[laneIndex] < queue.size()) {
+            int slot = queue.at(passedFront[laneIndex]);
+            if (along(slot) + length[slot] / 2 < line) break;
+            if (flags[slot] & FLAG_STOPPED) stoppedCount--;
+            flags[slot] = (flags[slot] & ~FLAG_STOPPED) | FLAG_PASSED;
+            passedFront[laneIndex]++;
+            waiting--;
+            departures++;
+        }
+    }
+
+    //  box of the vehicle for collison detection
+    sf::FloatRect getBoundingBox(int slot) const {
+        const sf::IntRect& rect = TextureCache::instance().rect(skin[slot]);
+        float w = rect.width, h = rect.height;
+        if (direction == 1 || direction == 3) {
+            std::swap(w, h);  // rotated sideways
+        }
+        return sf::FloatRect(posX[slot] - w / 2, posY[slot] - h / 2, w, h);
+    }
+
+    bool isAtIntersection(int slot) const {
+        intersectionBox box;
+        const float BUFFER = 20.0f;  // Buffer zone before intersection
+        float x = posX[slot], y = posY[slot];
+        
+        switch(direction) {
+            case 0: // NORTH
+                if (y > box.top.y ) return false;
+                return y > box.top.y - BUFFER && y < box.top.y + box.dim.y;
+            case 1: // WEST
+                if (x > box.top.x) return false;
+                return x > box.top.x - BUFFER && x < box.top.x + box.dim.x;
+            case 2: // SOUTH
+                if (y < box.top.y + box.dim.y ) return false;
+                return y < box.top.y + box.dim.y + BUFFER && y > box.top.y;
+            case 3: // EAST
+                if (x < box.top.x + box.dim.x) return false;
+                return x < box.top.x + box.dim.x + BUFFER && x > box.top.x;
+        }
+        return false;
+    }
+
+    void update(int slot, float deltaTime, bool isGreenLight, uint32_t tick) {
+        bool emergency = isEmergency(slot);
+        bool atIntersection = isAtIntersection(slot);
+
+        // Update speed every 5 seconds 
+        speedUpdateTimer[slot] += deltaTime;
+        if(speedUpdateTimer[slot] >= 5.0f) {
+            speedUpdateTimer[slot] = 0;
+            if (!atIntersection || isGreenLight || emergency) {
+                float newSpeed = currentSpeed[slot] + 5.0f;
+                if (RandomStream(RNG_VEHICLE, id[slot], tick).below(100) < 5) {
+                    currentSpeed[slot] = std::min(newSpeed * 1.2f, maxSpeed[slot] * 1.2f); // 20% increase
+                } else {
+                    currentSpeed[slot] = std::min(newSpeed, maxSpeed[slot]);
+                }
             }
         }
+
+        // Stop at red light unless emergency vehicle
+        if (atIntersection && !isGreenLight && !emergency) {
+            currentSpeed[slot] = 0;
+            return;
+        }
+
+        // Move vehicle 
+        float movement = currentSpeed[slot] * deltaTime;
+        switch(direction) {
+            case 0: // NORTH
+                posY[slot] += movement;  // Move down
+                break;
+            case 1: // WEST
+                posX[slot] += movement;  // Move right
+                break;
+            case 2: // SOUTH
+                posY[slot] -= movement; // Move up
+                break;
+            case 3: // EAST
+                posX[slot] -= movement; // Move left
+                break;
+        }
+    }
 };
 
-int Vehicle::numVehicles = 0; 
-#endif
\ No newline at end of file
+std::atomic<int> VehicleTable::numVehicles{0}; 
+#endif
@@ -21,44 +21,23 @@ private:
     std::vector<int> queueCounts;  // Track number of vehicles in queue per direction
     static const int MAX_QUEUE_SIZE = MAX_VEHICLES_PER_LANE;  // Same as lane capacity
 
+public:
+    std::vector<VehicleTable*> vehicles;  // Reference to vehicles from simulation
+
+    // Only the lane tail can be near the spawn point, so this is O(1)
     bool isSpawnAreaClear(int direction, int lane) const {
         if (!vehicles[direction]) return true;  // Safety check
         
         const float SPAWN_SAFE_DISTANCE = 100.0f;  // Increased safe distance for spawning
-        sf::Vector2f spawnPoint(SPAWN_POINTS[direction].x, SPAWN_POINTS[direction].y);
+        const VehicleTable& table = *vehicles[direction];
+        int tail = table.tail(lane);
+        if (tail < 0) return true;
         
-        //=the last spawned vehicle's position in this direction
-        for (const auto& vehicle : *vehicles[direction]) {
-            if (vehicle->lane != lane) continue;
-            
-            sf::Vector2f vehiclePos = vehicle->veh.getPosition();
-            float distance = 0;
-            
-            switch(direction) {
-                case 0: // North
-                    distance = spawnPoint.y - vehiclePos.y;
-                    break;
-                case 1: // West
-                    distance = vehiclePos.x - spawnPoint.x;
-                    break;
-                case 2: // South
-                    distance = vehiclePos.y - spawnPoint.y;
-                    break;
-                case 3: // East
-                    distance = spawnPoint.x - vehiclePos.x;
-                    break;
-            }
-            
-            if (distance < SPAWN_SAFE_DISTANCE && distance > -SPAWN_SAFE_DISTANCE) {
-                return false;
-            }
-        }
-        return true;
+        // spawn point sits at along() == 0 for every direction
+        float distance = table.along(tail);
+        return !(distance < SPAWN_SAFE_DISTANCE && distance > -SPAWN_SAFE_DISTANCE);
     }
 
-public:
-    std::vector<std::vector<Vehicle*>*> vehicles;  // Reference to vehicles from simulation
-
     VehicleSpawner() {
         spawnTimers = std::vector<float>(4, 0.0f);
         emergencyTimers = std::vector<float>(4, 0.0f);
@@ -67,10 +46,10 @@ public:
         pendingVehicles = std::vector<std::priority_queue<PendingVehicle>>(4);
         currentTime = time(nullptr);
         queueCounts = std::vector<int>(4, 0);
-        vehicles = std::vector<std::vector<Vehicle*>*>(4, nullptr);
+        vehicles = std::vector<VehicleTable*>(4, nullptr);
     }
 
-    void setVehicles(std::vector<std::vector<Vehicle*>*>& vehiclesList) {
+    void setVehicles(std::vector<VehicleTable*>& vehiclesList) {
         vehicles = vehiclesList;
     }
 
@@ -86,17 +65,20 @@ public:
         return laneCounts[direction][lane-1] < MAX_VEHICLES_PER_LANE;
     }
 
-    int getLeastOccupiedLane(int direction) {
+    // Random draws take the direction's stream for this tick, see spawnVehicles
+    int getLeastOccupiedLane(int direction, RandomStream& rng) {
         if (laneCounts[direction][0] == laneCounts[direction][1]) {
-            return (rand() % 2) + 1;  // Random lane if equal
+            return rng.below(2) + 1;  // Random lane if equal
         }
         return (laneCounts[direction][0] < laneCounts[direction][1]) ? 1 : 2;
     }
 
     bool isHeavyVehicleAllowed() {
         // Check if current time is during peak hours
-        struct tm* timeinfo = localtime(&currentTime);
-        int timeOfDay = timeinfo->tm_hour * 3600 + timeinfo->tm_min * 60 + timeinfo->tm_sec;
+        // directions spawn in parallel, localtime's shared buffer would race
+        struct tm timeinfo;
+        localtime_r(&currentTime, &timeinfo);
+        int timeOfDay = timeinfo.tm_hour * 3600 + timeinfo.tm_min * 60 + timeinfo.tm_sec;
 
         bool isMorningPeak = (timeOfDay >= TIME_7AM && timeOfDay <= TIME_930AM);
         bool isEveningPeak = (timeOfDay >= TIME_430PM && timeOfDay <= TIME_830PM);
@@ -104,11 +86,11 @@ public:
         return !(isMorningPeak || isEveningPeak);
     }
 
-    bool shouldSpawnHeavyVehicle(int direction, float deltaTime) {
+    bool shouldSpawnHeavyVehicle(int direction, float deltaTime, RandomStream& rng) {
         if (!isHeavyVehicleAllowed()) return false;
 
         heavyVehicleTimers[direction] += deltaTime;
-        if(heavyVehicleTimers[direction] >= (15.0f + rand() % 10)) {
+        if(heavyVehicleTimers[direction] >= (15.0f + rng.below(10))) {
             heavyVehicleTimers[direction] = 0;
             if (isLaneAvailable(direction, 2) && isSpawnAreaClear(direction, 2)) {
                 return true;
@@ -119,7 +101,7 @@ public:
         return false;
     }
 
-    bool shouldSpawnEmergency(int direction, float deltaTime) {
+    bool shouldSpawnEmergency(int direction, float deltaTime, RandomStream& rng) {
         emergencyTimers[direction] += deltaTime;
         
         float emergencyInterval;
@@ -139,6 +121,7 @@ public:
                 emergencyChance = 0.05f;
                 break;
             case 3: // East
+            default:
                 emergencyInterval = 20.0f;
                 emergencyChance = 0.10f;
                 break;
@@ -146,7 +129,7 @@ public:
 
         if(emergencyTimers[direction] >= emergencyInterval) {
             emergencyTimers[direction] = 0;
-            if ((float(rand()) / RAND_MAX) < emergencyChance) {
+            if (rng.uniform() < emergencyChance) {
                 if (!isLaneAvailable(direction, 1) && !isLaneAvailable(direction, 2) && !isQueueFull(direction)) {
                     addToPendingQueue("Emergency", direction);
                 }
@@ -164,7 +147,8 @@ public:
             case 0: spawnInterval = 1.0f; break;
             case 1: spawnInterval = 2.0f; break;
             case 2: spawnInterval = 2.0f; break;
-            case 3: spawnInterval = 1.5f; break;
+            case 3:
+            default: spawnInterval = 1.5f; break;
         }
 
         if(spawnTimers[direction] >= spawnInterval) {
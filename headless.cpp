@@ -0,0 +1,144 @@
+#include "headers/simulation.h"
+#include "headers/shard.h"
+#include <cstddef>
+#include <cstdlib>
+#include <new>
+
+// Counting allocator so the headless report can show heap traffic per run.
+// Every replaceable new and delete form goes through these two, so array
+// and over-aligned allocations are counted too. noinline keeps the
+// compiler from pairing a free() with an inlined operator new.
+__attribute__((noinline)) static void* countedAlloc(std::size_t size, std::size_t alignment) {
+    heapAllocationCount.fetch_add(1, std::memory_order_relaxed);
+    if (size == 0) size = 1;
+    void* p = nullptr;
+    if (alignment <= alignof(std::max_align_t)) {
+        p = std::malloc(size);
+    } else if (posix_memalign(&p, alignment, size) != 0) {
+        p = nullptr;
+    }
+    if (!p) throw std::bad_alloc();
+    return p;
+}
+
+__attribute__((noinline)) static void countedFree(void* p) noexcept {
+    std::free(p);
+}
+
+void* operator new(std::size_t size) { return countedAlloc(size, 0); }
+void* operator new[](std::size_t size) { return countedAlloc(size, 0); }
+void* operator new(std::size_t size, std::align_val_t align) { return countedAlloc(size, (std::size_t)align); }
+void* operator new[](std::size_t size, std::align_val_t align) { return countedAlloc(size, (std::size_t)align); }
+
+void operator delete(void* p) noexcept { countedFree(p); }
+void operator delete[](void* p) noexcept { countedFree(p); }
+void operator delete(void* p, std::size_t) noexcept { countedFree(p); }
+void operator delete[](void* p, std::size_t) noexcept { countedFree(p); }
+void operator delete(void* p, std::align_val_t) noexcept { countedFree(p); }
+void operator delete[](void* p, std::align_val_t) noexcept { countedFree(p); }
+void operator delete(void* p, std::size_t, std::align_val_t) noexcept { countedFree(p); }
+void operator delete[](void* p, std::size_t, std::align_val_t) noexcept { countedFree(p); }
+
+// Steps a road network file or a generated grid instead of the single
+// intersection
+static int runNetwork(const std::string& networkFile, const std::string& grid,
+                      int workers, int partitionCount, int shards, float seconds, float speed) {
+    RoadNetwork network;
+    std::string error;
+    int rows = 0, cols = 0;
+    bool loaded = networkFile.empty()
+        ? sscanf(grid.c_str(), "%dx%d", &rows, &cols) == 2 && rows > 0 && cols > 0 &&
+          network.loadGrid(rows, cols, error)
+        : network.loadFile(networkFile.c_str(), error);
+    if (!loaded) {
+        std::cerr << "Failed to load network: " << (error.empty() ? grid : error) << std::endl;
+        return 1;
+    }
+    if (shards > 0) {
+        ShardCoordinator coordinator(network, shards);
+        return coordinator.run(seconds, speed) ? 0 : 1;
+    }
+    TaskScheduler scheduler(workers);
+    network.partition(partitionCount > 0 ? partitionCount : scheduler.size() * 4);
+    network.runHeadless(scheduler, seconds, speed);
+    return 0;
+}
+
+// Renderer-free run for throughput measurements, no windows or textures.
+// Usage: ./traffic_headless [start hour 0-23] [--idm] [--workers N] [--seed N] [--seconds S]
+//                           [--speed X] [--signals fixed|actuated|pressure]
+//                           [--metrics-port P] [--metrics-file F]
+//        ./traffic_headless --network FILE | --grid RxC [--partitions N] [--seconds S] [--workers N]
+//                           [--shards N] [--seed N]
+// The same seed gives the same run whatever the worker, partition or
+// shard count. --speed paces the run at X simulated seconds per wall
+// second, networks and shards included; default 0 is as fast as possible.
+// Metrics are only exported when --metrics-port or --metrics-file is given.
+int main(int argc, char* argv[]) {
+    rngSeed = (uint64_t)time(nullptr);
+    int startHour = 0;
+    int workers = 0;  // one per hardware thread
+    int partitionCount = 0;  // four per worker
+    int shards = 0;          // processes, 0 runs the network in this one
+    float seconds = SIMTIME;
+    float speed = 0.0f;
+    std::string signals = "fixed";
+    int metricsPort = 0;  // off, headless runs stay self contained
+    std::string metricsFile;
+    std::string networkFile, grid;
+    CarFollowingMode mode = FOLLOW_CLASSIC;
+    for (int i = 1; i < argc; i++) {
+        std::string arg = argv[i];
+        if (arg == "--idm") {
+            mode = FOLLOW_IDM;
+        } else if (arg == "--workers" && i + 1 < argc) {
+            workers = atoi(argv[++i]);
+        } else if (arg == "--network" && i + 1 < argc) {
+            networkFile = argv[++i];
+        } else if (arg == "--grid" && i + 1 < argc) {
+            grid = argv[++i];
+        } else if (arg == "--partitions" && i + 1 < argc) {
+            partitionCount = atoi(argv[++i]);
+        } else if (arg == "--shards" && i + 1 < argc) {
+            shards = atoi(argv[++i]);
+        } else if (arg == "--seconds" && i + 1 < argc) {
+            seconds = atof(argv[++i]);
+        } else if (arg == "--signals" && i + 1 < argc) {
+            signals = argv[++i];
+        } else if (arg == "--speed" && i + 1 < argc) {
+            speed = atof(argv[++i]);
+        } else if (arg == "--seed" && i + 1 < argc) {
+            rngSeed = strtoull(argv[++i], nullptr, 10);
+        } else if (arg == "--metrics-port" && i + 1 < argc) {
+            metricsPort = atoi(argv[++i]);
+        } else if (arg == "--metrics-file" && i + 1 < argc) {
+            metricsFile = argv[++i];
+        } else {
+            startHour = atoi(argv[i]) % 24;
+        }
+    }
+    std::cout << "Seed: " << rngSeed << std::endl;
+    if (!networkFile.empty() || !grid.empty()) {
+        return runNetwork(networkFile, grid, workers, partitionCount, shards, seconds, speed);
+    }
+    SignalController* controller = makeSignalController(signals);
+    if (!controller) {
+        std::cerr << "Unknown signal controller: " << signals << std::endl;
+        return 1;
+    }
+    Simulation sim(true, workers);
+    MetricsExporter exporter;
+    if (metricsPort > 0 || !metricsFile.empty()) {
+        MetricsRegistry::reset();
+        sim.enableMetrics();
+        if (!exporter.start(metricsPort, metricsFile, METRICS_INTERVAL_MS)) {
+            std::cerr << "Metrics port " << metricsPort << " unavailable" << std::endl;
+        }
+    }
+    sim.trafficManager.setController(controller);
+    sim.carFollowing = mode;
+    sim.clock.setCompression(speed);
+    sim.duration = seconds;
+    sim.startHeadless(startHour);
+    return 0;
+}
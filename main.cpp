@@ -1,8 +1,52 @@
 #include "headers/simulation.h"
 
-int main() {
-    srand(time(nullptr));
+// Usage: ./traffic [--seed N] [--speed X] [--seconds S] [--signals fixed|actuated|pressure]
+//                  [--metrics-port P] [--metrics-file F]
+// A random seed per run if none is given. --speed runs X simulated
+// seconds per wall second (0 as fast as possible), --seconds sets the run
+// length, e.g. 1440 for a full day on the 1 sec = 1 min clock. Metrics of
+// every process are served on 127.0.0.1:P (0 turns the endpoint off) and
+// written to F (empty for none).
+int main(int argc, char* argv[]) {
+    rngSeed = (uint64_t)time(nullptr);
+    float speed = 1.0f;
+    float seconds = SIMTIME;
+    std::string signals = "fixed";
+    int metricsPort = METRICS_PORT;
+    std::string metricsFile = METRICS_FILE;
+    for (int i = 1; i + 1 < argc; i += 2) {
+        std::string arg = argv[i];
+        if (arg == "--seed") {
+            rngSeed = strtoull(argv[i + 1], nullptr, 10);
+        } else if (arg == "--speed") {
+            speed = atof(argv[i + 1]);
+        } else if (arg == "--seconds") {
+            seconds = atof(argv[i + 1]);
+        } else if (arg == "--signals") {
+            signals = argv[i + 1];
+        } else if (arg == "--metrics-port") {
+            metricsPort = atoi(argv[i + 1]);
+        } else if (arg == "--metrics-file") {
+            metricsFile = argv[i + 1];
+        }
+    }
+    std::cout << "Seed: " << rngSeed << std::endl;
+    SignalController* controller = makeSignalController(signals);
+    if (!controller) {
+        std::cerr << "Unknown signal controller: " << signals << std::endl;
+        return 1;
+    }
+    MetricsRegistry::reset();  // before the challan processes attach
     Simulation sim;
+    sim.enableMetrics();
+    MetricsExporter exporter;
+    if (!exporter.start(metricsPort, metricsFile, METRICS_INTERVAL_MS)) {
+        std::cerr << "Metrics port " << metricsPort << " unavailable, writing " << metricsFile
+                  << " only" << std::endl;
+    }
+    sim.trafficManager.setController(controller);
+    sim.clock.setCompression(speed);
+    sim.duration = seconds;
     sim.start();
     return 0;
-}
\ No newline at end of file
+}
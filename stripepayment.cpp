@@ -4,6 +4,8 @@
 #include <unistd.h>
 #include <fcntl.h>
 #include <sys/stat.h>
+#include "headers/ipc.h"
+#include "headers/metrics.h"
 
 class StripePayment {
 public:
@@ -19,9 +21,15 @@ public:
     std::string inputAmount;
     std::string creditCardNumber;
     bool isPaid;
+    Counter paidMetric;          // exported through the simulator
+    Counter insufficientMetric;
 
     StripePayment(const std::string& challanId, const std::string& vehicleNumber, const std::string& vehicleType, float amount)
         : challanId(challanId), vehicleNumber(vehicleNumber), vehicleType(vehicleType), amount(amount),isPaid(false) {
+        MetricsRegistry& registry = MetricsRegistry::instance();
+        paidMetric = registry.counter("stripepayment_payments_total", "Payment attempts by outcome", "result=\"paid\"");
+        insufficientMetric = registry.counter("stripepayment_payments_total", "Payment attempts by outcome",
+                                              "result=\"insufficient\"");
         window.create(sf::VideoMode(400, 300), "Stripe Payment");
         window.setPosition({1000,500});
         if (!font.loadFromFile("res/CaskaydiaCove.ttf")) {
@@ -74,9 +82,11 @@ public:
         if (paidAmount >= amount) {
             statusText.setString("Payment Successful!");
             isPaid = true;
+            paidMetric.add();
             notifyUserPortal(challanId, vehicleNumber);
         } else {
             statusText.setString("Insufficient Amount!");
+            insufficientMetric.add();
         }
     }
 
@@ -90,15 +100,21 @@ public:
         int fdChallan = open(challanFifoPath, O_WRONLY);
         int fdUserPortal = open(userPortalFifoPath, O_WRONLY);
 
+        PaymentMessage payment;
+        memset(&payment, 0, sizeof(payment));
+        payment.challanId = strtoull(challanId.c_str(), nullptr, 10);
+        strncpy(payment.plate, vehicleNumber.c_str(), sizeof(payment.plate) - 1);
+        payment.status = CHALLAN_PAID;
+        std::string frame;
+        appendFrame(frame, IPC_PAYMENT, &payment, sizeof(payment));
+
         if (fdChallan != -1) {
-            std::string paymentStatus = challanId + "," + vehicleNumber + ",Paid";
-            write(fdChallan, paymentStatus.c_str(), paymentStatus.size());
+            write(fdChallan, frame.data(), frame.size());
             close(fdChallan);
         }
 
         if (fdUserPortal != -1) {
-            std::string paymentStatus = challanId + "," + vehicleNumber + ",Paid";
-            write(fdUserPortal, paymentStatus.c_str(), paymentStatus.size());
+            write(fdUserPortal, frame.data(), frame.size());
             close(fdUserPortal);
         }
     }
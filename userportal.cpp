@@ -7,29 +7,48 @@
 #include <fcntl.h>
 #include <sys/stat.h>
 #include <sstream>
-#include <map>
+#include <cstring>
+#include <sys/ioctl.h>
+#include "headers/challanledger.h"
+#include "headers/ipc.h"
+#include "headers/eventloop.h"
+#include "headers/metrics.h"
 
 
-struct ChallanDetails {
-    std::string challanId;
-    std::string vehicleNumber;
-    std::string vehicleType;
-    std::string paymentStatus;
-    float amount;
-};
-
 class UserPortal {
 public:
     sf::RenderWindow window;
     sf::Font font;
     sf::Text displayText;
     sf::Text inputText;
-    std::vector<ChallanDetails> challans;
-    std::map<std::string, ChallanDetails> challanMap;
+    ChallanStore challans;  // unpaid challans by id and plate
+    ChallanLedger ledger;   // durable history, rebuilds challans on start
     std::string inputVehicleId;
     bool correct;
+    bool dirty;  // redraw on the next frame tick
+
+    EventLoop loop;
+    FrameDecoder challanDecoder;
+    FrameDecoder paymentDecoder;
+    LatencyHistogram portalLatency;  // episode end -> challan shown here
+
+    // exported through the simulator, see headers/metrics.h
+    Counter receivedMetric;
+    Counter settledMetric;
+    Gauge unpaidMetric;
+    Gauge challanFifoMetric;
+    Gauge paymentFifoMetric;
+
+    UserPortal() : dirty(true) {
+        MetricsRegistry& registry = MetricsRegistry::instance();
+        receivedMetric = registry.counter("userportal_challans_received_total", "Challans received by the user portal");
+        settledMetric = registry.counter("userportal_settled_total", "Challans settled in the user portal");
+        unpaidMetric = registry.gauge("challan_unpaid", "Unpaid challans held by each process", "process=\"userportal\"");
+        challanFifoMetric = registry.gauge("fifo_pending_bytes", "Bytes waiting in a FIFO when its reader woke up",
+                                           "fifo=\"userportal_fifo\"");
+        paymentFifoMetric = registry.gauge("fifo_pending_bytes", "Bytes waiting in a FIFO when its reader woke up",
+                                           "fifo=\"userportal_payment_fifo\"");
 
-    UserPortal() {
         window.create(sf::VideoMode(600, 400), "User Portal");
         window.setPosition({1000, 100});
         
@@ -51,8 +70,11 @@ public:
         correct = false;
         sf::Event event;
         while (window.pollEvent(event) && !correct) {
+            dirty = true;
             if (event.type == sf::Event::Closed) {
                 window.close();
+                loop.stop();
+                return;
             }
             if (event.type == sf::Event::TextEntered) {
                 if (event.text.unicode < 128) {
@@ -72,13 +94,15 @@ public:
     }
 
     void processChallanPayment() {
-        if (challanMap.find(inputVehicleId) != challanMap.end()) {
-            ChallanDetails& challan = challanMap[inputVehicleId];
+        const ChallanEntry* challan = challans.findByPlate(inputVehicleId);
+        if (challan) {
             correct = true;
-            std::string command = "./stripepayment " + challan.challanId + " " + challan.vehicleNumber + " " + challan.vehicleType + " " + std::to_string(challan.amount);
+            std::string challanId = std::to_string(challan->id);
+            std::string vehicleType = challan->isHeavy ? "Heavy" : "Light";
+            std::string amount = std::to_string(challan->amount);
             int pid = fork();
             if (pid == 0) {
-                execlp("./stripepayment", "stripepayment", challan.challanId.c_str(), challan.vehicleNumber.c_str(), challan.vehicleType.c_str(), std::to_string(challan.amount).c_str(), nullptr);
+                execlp("./stripepayment", "stripepayment", challanId.c_str(), challan->plate, vehicleType.c_str(), amount.c_str(), nullptr);
             }
             else{
                 wait(NULL);
@@ -90,81 +114,119 @@ public:
         }
     }
 
-    void addChallan(const ChallanDetails& challan) {
-        challans.push_back(challan);
-        challanMap[challan.vehicleNumber] = challan;
+    void addChallan(const ChallanEntry& challan) {
+        if (challans.insert(challan)) {
+            ledger.append(LEDGER_ISSUE, challan);
+            receivedMetric.add();
+            unpaidMetric.set(challans.size());
+        }
+    }
+
+    void settleChallan(uint64_t id, const std::string& vehicleNumber) {
+        const ChallanEntry* found = challans.find(id);
+        if (!found) found = challans.findByPlate(vehicleNumber);
+        if (!found) return;
+        ChallanEntry paid = *found;
+        paid.status = CHALLAN_PAID;
+        ledger.append(LEDGER_PAY, paid);
+        challans.settle(paid.id);
+        settledMetric.add();
+        unpaidMetric.set(challans.size());
     }
 
     void displayChallans() {
+        const size_t MAX_LINES = 15;
         std::stringstream ss;
-        for (const auto& challan : challans) {
-            ss << "Challan ID: " << challan.challanId << "\n";
+        size_t lines = 0;
+        for (const auto& pair : challans.entries()) {
+            if (lines++ == MAX_LINES) {
+                ss << "... " << challans.size() - MAX_LINES << " more\n";
+                break;
+            }
+            const ChallanEntry& challan = pair.second;
+            ss << "Challan ID: " << challan.id << " " << challan.plate << " " << challan.amount << " PKR\n";
         }
         displayText.setString(ss.str());
     }
 
+    void drainChallans(int fd) {
+        int pending = 0;
+        if (ioctl(fd, FIONREAD, &pending) == 0) challanFifoMetric.set(pending);
+        challanDecoder.readFrom(fd);
+        FrameHeader header;
+        const char* payload;
+        uint64_t now = monotonicNs();
+        while (challanDecoder.next(header, payload)) {
+            if (header.type != IPC_CHALLAN_ISSUED || header.length != sizeof(ChallanIssued)) continue;
+            ChallanIssued issued;
+            memcpy(&issued, payload, sizeof(issued));
+            issued.entry.plate[sizeof(issued.entry.plate) - 1] = '\0';
+            portalLatency.record(issued.detectedNs, now);
+            addChallan(issued.entry);
+            dirty = true;
+        }
+    }
+
+    void drainPayments(int fd) {
+        int pending = 0;
+        if (ioctl(fd, FIONREAD, &pending) == 0) paymentFifoMetric.set(pending);
+        paymentDecoder.readFrom(fd);
+        FrameHeader header;
+        const char* payload;
+        while (paymentDecoder.next(header, payload)) {
+            if (header.type != IPC_PAYMENT || header.length != sizeof(PaymentMessage)) continue;
+            PaymentMessage payment;
+            memcpy(&payment, payload, sizeof(payment));
+            payment.plate[sizeof(payment.plate) - 1] = '\0';
+            if (payment.status == CHALLAN_PAID) {
+                settleChallan(payment.challanId, payment.plate);
+                dirty = true;
+            }
+        }
+    }
+
+    void render() {
+        if (!dirty) return;
+        dirty = false;
+        displayChallans();
+        inputText.setString("Enter Vehicle ID: " + inputVehicleId);
+
+        window.clear(sf::Color::White);
+        window.draw(displayText);
+        window.draw(inputText);
+        window.display();
+    }
+
     void run() {
+        if (ledger.open("userportal.ledger", challans)) {
+            std::cout << "Ledger: " << ledger.recovered << " records, " << challans.size()
+                      << " unpaid, rebuilt in " << ledger.recoveryMs << " ms" << std::endl;
+        } else {
+            std::cerr << "Failed to open userportal.ledger, challans will not survive a restart." << std::endl;
+        }
+        unpaidMetric.set(challans.size());
+
         const char* userPortalFifoPath = "/tmp/userportal_fifo";
         const char* paymentFifoPath = "/tmp/userportal_payment_fifo";
-        mkfifo(userPortalFifoPath, 0666);
-        mkfifo(paymentFifoPath, 0666);
-
-        int fd = open(userPortalFifoPath, O_RDONLY | O_NONBLOCK);
-        int fdPayment = open(paymentFifoPath, O_RDONLY | O_NONBLOCK);
 
+        int fd = loop.watchFifo(userPortalFifoPath, [this](int fd) { drainChallans(fd); });
+        int fdPayment = loop.watchFifo(paymentFifoPath, [this](int fd) { drainPayments(fd); });
         if (fd == -1 || fdPayment == -1) {
             std::cerr << "Failed to open FIFO for reading." << std::endl;
             return;
         }
-
-        char buffer[256];
-        while (window.isOpen()) {
+        loop.addTimer(33, [this](int) {
             handleInput();
+            ledger.syncIfDue();
+            render();
+        });
 
-            int bytesRead = read(fd, buffer, sizeof(buffer));
-            if (bytesRead > 0) {
-                buffer[bytesRead] = '\0';
-                std::string challanDetails(buffer);
-                std::istringstream iss(challanDetails);
-                std::string vehicleId, amount, issueDate, dueDate;
-                std::getline(iss, vehicleId, ',');
-                std::getline(iss, amount, ',');
-                std::getline(iss, issueDate, ',');
-                std::getline(iss, dueDate, ',');
-
-                ChallanDetails challan = {vehicleId, vehicleId, "Unknown", "Unpaid", std::stof(amount)};
-                addChallan(challan);
-            }
-
-            int paymentBytesRead = read(fdPayment, buffer, sizeof(buffer));
-            if (paymentBytesRead > 0) {
-                buffer[paymentBytesRead] = '\0';
-                std::string paymentStatus(buffer);
-                std::istringstream iss(paymentStatus);
-                std::string challanId, vehicleNumber, status;
-                std::getline(iss, challanId, ',');
-                std::getline(iss, vehicleNumber, ',');
-                std::getline(iss, status, ',');
-
-                if (status == "Paid") {
-                    challanMap.erase(vehicleNumber);
-                    challans.erase(std::remove_if(challans.begin(), challans.end(),
-                        [&vehicleNumber](const ChallanDetails& c) { return c.vehicleNumber == vehicleNumber; }),
-                        challans.end());
-                }
-            }
-
-            displayChallans();
-            inputText.setString("Enter Vehicle ID: " + inputVehicleId);
-
-            window.clear(sf::Color::White);
-            window.draw(displayText);
-            window.draw(inputText);
-            window.display();
-        }
+        loop.run();
 
-        close(fd);
-        close(fdPayment);
+        ledger.sync();
+        portalLatency.print("Violation to portal");
+        std::cout << "Event loop: " << loop.wakeups << " wakeups, "
+                  << loop.rearms << " FIFO re-arms" << std::endl;
     }
 };
 